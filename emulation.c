@@ -0,0 +1,386 @@
+/* emulation.c
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#include "tinycthread.h"
+#include "emulation.h"
+
+#ifdef _WIN32
+  #include <windows.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+// state of one emulated link, every link draws from its own random sequence so that its verdicts
+// only depend on the seed and the number of frames sent over it...
+typedef struct EmulatedLink {
+  int from_port;
+  int to_port;
+  const LinkEmulation *emulation;
+  uint64_t random_state;
+  long long busy_until_usecs; // end of the transmission of the last frame, for bandwidth limits
+  struct EmulatedLink *next;
+} EmulatedLink;
+
+// a delivery waiting for the delay of its link...
+typedef struct EmulatedDelivery {
+  long long due_usecs;
+  const void *owner;
+  EmulationDelivery deliver;
+  void *arg;
+  struct EmulatedDelivery *next;
+} EmulatedDelivery;
+
+// the deliveries over a link in the order they were scheduled, run by a thread of the lane that
+// exits once they are done. lanes outlive the link states they were scheduled with...
+typedef struct DeliveryLane {
+  int from_port;
+  int to_port;
+  EmulatedDelivery *first;
+  EmulatedDelivery *last;
+  long length;
+  const void *running_owner; // of the delivery being run, NULL if none
+  cnd_t changed; // signalled when deliveries are cancelled
+  struct DeliveryLane *next;
+} DeliveryLane;
+
+
+static LinkEmulation *links = NULL; // protected by links_mutex, like everything below
+static unsigned n_links = 0;
+static unsigned long links_seed = 0;
+static EmulatedLink *link_states[EMULATION_LINK_BUCKETS];
+static DeliveryLane *lanes[EMULATION_LINK_BUCKETS];
+static cnd_t delivery_done; // signalled whenever a lane has run a delivery
+static int enabled = 0;
+static mtx_t links_mutex;
+static once_flag links_once = ONCE_FLAG_INIT;
+
+static void links_init(void) {
+  mtx_init(&links_mutex, mtx_plain);
+  cnd_init(&delivery_done);
+}
+
+static long long emulation_monotonic_usecs() {
+#ifdef _WIN32
+  return (long long) GetTickCount() * 1000;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+static uint64_t random_next(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL); // splitmix64
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static double random_uniform(uint64_t *state) {
+  return (random_next(state) >> 11) * (1.0 / 9007199254740992.0); // [0, 1) with 53 bits
+}
+
+static unsigned long link_bucket(const int from_port, const int to_port) {
+  return ((unsigned long) from_port * 65537UL + (unsigned long) to_port) % EMULATION_LINK_BUCKETS;
+}
+
+static void clear_link_states(void) {
+  // this assumes that we have a mutex lock on links!
+  for (int i = 0; i < EMULATION_LINK_BUCKETS; i++) {
+    while (link_states[i] != NULL) {
+      EmulatedLink *next = link_states[i]->next;
+      free(link_states[i]);
+      link_states[i] = next;
+    }
+  }
+}
+
+// find the state of a link, creating it on its first frame, or NULL if no rule matches...
+static EmulatedLink *find_link(const int from_port, const int to_port) {
+  // this assumes that we have a mutex lock on links!
+  const unsigned long bucket = link_bucket(from_port, to_port);
+  for (EmulatedLink *link = link_states[bucket]; link != NULL; link = link->next) {
+    if (link->from_port == from_port && link->to_port == to_port) {
+      return link;
+    }
+  }
+  for (unsigned i = 0; i < n_links; i++) { // the first matching rule applies
+    if ((links[i].from_port == 0 || links[i].from_port == from_port)
+        && (links[i].to_port == 0 || links[i].to_port == to_port)) {
+      EmulatedLink *link = (EmulatedLink *) malloc(sizeof(EmulatedLink));
+      link->from_port = from_port;
+      link->to_port = to_port;
+      link->emulation = &links[i];
+      link->random_state = (uint64_t) links_seed ^ ((uint64_t) from_port << 32 | (uint64_t) to_port);
+      link->busy_until_usecs = 0;
+      link->next = link_states[bucket];
+      link_states[bucket] = link;
+      return link;
+    }
+  }
+  return NULL;
+}
+
+int emulation_set_links(const unsigned n, const LinkEmulation new_links[n], const unsigned long seed) {
+  call_once(&links_once, &links_init);
+  LinkEmulation *links_copy = NULL;
+  if (n > 0) {
+    links_copy = (LinkEmulation *) malloc(n * sizeof(LinkEmulation));
+    memcpy(links_copy, new_links, n * sizeof(LinkEmulation));
+  }
+  mtx_lock(&links_mutex);
+  clear_link_states();
+  free(links);
+  links = links_copy;
+  n_links = n;
+  links_seed = seed;
+  __atomic_store_n(&enabled, n > 0, __ATOMIC_RELAXED);
+  mtx_unlock(&links_mutex);
+  return EXIT_SUCCESS;
+}
+
+static int parse_port(const char *token, int *port) {
+  if (strcmp(token, "*") == 0) {
+    *port = 0;
+    return EXIT_SUCCESS;
+  }
+  char *end;
+  const long value = strtol(token, &end, 10);
+  if (*end != '\0' || value < 1 || value > 65535) {
+    return EXIT_FAILURE;
+  }
+  *port = (int) value;
+  return EXIT_SUCCESS;
+}
+
+// one link per line: from_port to_port delay_msecs jitter_msecs loss_probability
+// refusal_probability bandwidth, '*' matches any port, '#' starts a comment...
+int emulation_load_links(const char *path, const unsigned long seed) {
+  FILE *file = fopen(path, "r");
+  if (NULL == file) {
+    fprintf(stderr, "emulation_load_links: error opening link emulation file '%s'.\n", path);
+    return EXIT_FAILURE;
+  }
+  LinkEmulation *new_links = NULL;
+  unsigned n = 0, capacity = 0, line_number = 0;
+  char line[EMULATION_MAX_LINE_LENGTH];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_number++;
+    char *comment = strchr(line, '#');
+    if (comment != NULL) {
+      *comment = '\0';
+    }
+    char from[16], to[16], rest;
+    LinkEmulation link;
+    const int n_fields = sscanf(line, "%15s %15s %lf %lf %lf %lf %lf %c", from, to, &link.delay_msecs,
+                                &link.jitter_msecs, &link.loss_probability, &link.refusal_probability,
+                                &link.bandwidth, &rest);
+    if (n_fields == EOF) { // empty line
+      continue;
+    }
+    if (n_fields != 7 || parse_port(from, &link.from_port) == EXIT_FAILURE
+        || parse_port(to, &link.to_port) == EXIT_FAILURE || link.delay_msecs < 0.0 || link.jitter_msecs < 0.0
+        || link.loss_probability < 0.0 || link.loss_probability > 1.0 || link.refusal_probability < 0.0
+        || link.refusal_probability > 1.0 || link.bandwidth < 0.0) {
+      fprintf(stderr, "emulation_load_links: invalid link in '%s' line %u.\n", path, line_number);
+      free(new_links);
+      fclose(file);
+      return EXIT_FAILURE;
+    }
+    if (n == capacity) {
+      capacity = capacity > 0 ? 2 * capacity : 16;
+      new_links = (LinkEmulation *) realloc(new_links, capacity * sizeof(LinkEmulation));
+    }
+    new_links[n++] = link;
+  }
+  fclose(file);
+  const int ret = emulation_set_links(n, new_links, seed);
+  free(new_links);
+  return ret;
+}
+
+int emulation_enabled(void) {
+  return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+EmulationVerdict emulation_apply(const int from_port, const int to_port, const long frame_length,
+                                 long long *delay_usecs) {
+  *delay_usecs = 0;
+  call_once(&links_once, &links_init);
+  mtx_lock(&links_mutex);
+  EmulatedLink *link = find_link(from_port, to_port);
+  if (NULL == link) { // unimpaired link
+    mtx_unlock(&links_mutex);
+    return EMULATION_DELIVER;
+  }
+  const LinkEmulation *emulation = link->emulation;
+  // always draw all random numbers, so that every frame advances the link's sequence equally...
+  const double refusal = random_uniform(&link->random_state);
+  const double jitter = random_uniform(&link->random_state);
+  const double loss = random_uniform(&link->random_state);
+  long long delay = (long long) ((emulation->delay_msecs + (2.0 * jitter - 1.0) * emulation->jitter_msecs) * 1000.0);
+  *delay_usecs = delay > 0 ? delay : 0;
+  if (refusal < emulation->refusal_probability) {
+    mtx_unlock(&links_mutex);
+    return EMULATION_REFUSE;
+  }
+  if (emulation->bandwidth > 0.0) { // queue the frame behind the frames still in transmission
+    const long long now = emulation_monotonic_usecs();
+    const long long start = link->busy_until_usecs > now ? link->busy_until_usecs : now;
+    link->busy_until_usecs = start + (long long) (frame_length / emulation->bandwidth * 1e6);
+    *delay_usecs += link->busy_until_usecs - now;
+  }
+  mtx_unlock(&links_mutex);
+  return loss < emulation->loss_probability ? EMULATION_LOSE : EMULATION_DELIVER;
+}
+
+// returns 1 if frames from islands on from_port to islands on to_port are impaired...
+int emulation_matches(const int from_port, const int to_port) {
+  call_once(&links_once, &links_init);
+  mtx_lock(&links_mutex);
+  const int matches = find_link(from_port, to_port) != NULL;
+  mtx_unlock(&links_mutex);
+  return matches;
+}
+
+static int lane_main(void *args) {
+  DeliveryLane *lane = (DeliveryLane *) args;
+  mtx_lock(&links_mutex);
+  while (lane->first != NULL) {
+    EmulatedDelivery *delivery = lane->first;
+    const long long wait_usecs = delivery->due_usecs - emulation_monotonic_usecs();
+    if (wait_usecs > 0) { // wait for the first delivery, later ones wait behind it even if due earlier
+      struct timespec deadline;
+      timespec_get(&deadline, TIME_UTC);
+      deadline.tv_sec += (time_t) (wait_usecs / 1000000);
+      deadline.tv_nsec += (long) (wait_usecs % 1000000) * 1000;
+      if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+      }
+      cnd_timedwait(&lane->changed, &links_mutex, &deadline);
+      continue;
+    }
+    lane->first = delivery->next;
+    if (NULL == lane->first) {
+      lane->last = NULL;
+    }
+    lane->length--;
+    lane->running_owner = delivery->owner;
+    mtx_unlock(&links_mutex);
+    delivery->deliver(delivery->arg, 0);
+    free(delivery);
+    mtx_lock(&links_mutex);
+    lane->running_owner = NULL;
+    cnd_broadcast(&delivery_done);
+  }
+  DeliveryLane **link = &lanes[link_bucket(lane->from_port, lane->to_port)];
+  while (*link != lane) {
+    link = &(*link)->next;
+  }
+  *link = lane->next;
+  mtx_unlock(&links_mutex);
+  cnd_destroy(&lane->changed);
+  free(lane);
+  return EXIT_SUCCESS;
+}
+
+// run deliver(arg) on the delivery thread of a link once delay_usecs have passed and the deliveries
+// scheduled before on the link are done. fails if max_pending deliveries are waiting already (0 for
+// no limit) or the thread cannot be started, deliver is not called then...
+int emulation_schedule(const int from_port, const int to_port, const long long delay_usecs, const long max_pending,
+                       const void *owner, const EmulationDelivery deliver, void *arg) {
+  call_once(&links_once, &links_init);
+  EmulatedDelivery *delivery = (EmulatedDelivery *) malloc(sizeof(EmulatedDelivery));
+  delivery->due_usecs = emulation_monotonic_usecs() + delay_usecs;
+  delivery->owner = owner;
+  delivery->deliver = deliver;
+  delivery->arg = arg;
+  delivery->next = NULL;
+  const unsigned long bucket = link_bucket(from_port, to_port);
+  mtx_lock(&links_mutex);
+  DeliveryLane *lane = lanes[bucket];
+  while (lane != NULL && (lane->from_port != from_port || lane->to_port != to_port)) {
+    lane = lane->next;
+  }
+  if (NULL == lane) { // first delivery over the link, or the first after its thread exited
+    lane = (DeliveryLane *) calloc(1, sizeof(DeliveryLane));
+    lane->from_port = from_port;
+    lane->to_port = to_port;
+    cnd_init(&lane->changed);
+    thrd_t thread;
+    if (thrd_create(&thread, &lane_main, lane) != thrd_success) {
+      mtx_unlock(&links_mutex);
+      cnd_destroy(&lane->changed);
+      free(lane);
+      free(delivery);
+      return EXIT_FAILURE;
+    }
+    thrd_detach(thread);
+    lane->next = lanes[bucket];
+    lanes[bucket] = lane;
+  } else if (max_pending > 0 && lane->length >= max_pending) {
+    mtx_unlock(&links_mutex);
+    free(delivery);
+    return EXIT_FAILURE;
+  }
+  if (NULL == lane->last) {
+    lane->first = delivery;
+  } else {
+    lane->last->next = delivery;
+  }
+  lane->last = delivery;
+  lane->length++;
+  mtx_unlock(&links_mutex);
+  return EXIT_SUCCESS;
+}
+
+// cancel the pending deliveries of an owner and wait for the ones being run...
+void emulation_cancel(const void *owner) {
+  call_once(&links_once, &links_init);
+  EmulatedDelivery *cancelled = NULL, **cancelled_end = &cancelled;
+  mtx_lock(&links_mutex);
+  for (int i = 0; i < EMULATION_LINK_BUCKETS; i++) {
+    for (DeliveryLane *lane = lanes[i]; lane != NULL; lane = lane->next) {
+      EmulatedDelivery **link = &lane->first;
+      lane->last = NULL;
+      while (*link != NULL) {
+        EmulatedDelivery *delivery = *link;
+        if (delivery->owner == owner) {
+          *link = delivery->next;
+          delivery->next = NULL;
+          *cancelled_end = delivery; // in order, as later pieces of a stream may free it
+          cancelled_end = &delivery->next;
+          lane->length--;
+        } else {
+          lane->last = delivery;
+          link = &delivery->next;
+        }
+      }
+      cnd_signal(&lane->changed);
+    }
+  }
+  for (;;) {
+    int running = 0;
+    for (int i = 0; i < EMULATION_LINK_BUCKETS && !running; i++) {
+      for (const DeliveryLane *lane = lanes[i]; lane != NULL && !running; lane = lane->next) {
+        running = lane->running_owner == owner;
+      }
+    }
+    if (!running) {
+      break;
+    }
+    cnd_wait(&delivery_done, &links_mutex);
+  }
+  mtx_unlock(&links_mutex);
+  while (cancelled != NULL) {
+    EmulatedDelivery *next = cancelled->next;
+    cancelled->deliver(cancelled->arg, 1);
+    free(cancelled);
+    cancelled = next;
+  }
+}
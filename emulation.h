@@ -0,0 +1,50 @@
+/* emulation.h
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#ifndef EMULATION_H
+#define EMULATION_H
+
+
+#define EMULATION_LINK_BUCKETS 256
+#define EMULATION_MAX_LINE_LENGTH 256
+#define EMULATION_MAX_PENDING_DELIVERIES 4096 // delayed frames per link, further frames fail
+
+
+// impairment of the links from islands on from_port to islands on to_port, a port of 0 matches
+// any island...
+typedef struct {
+  int from_port;
+  int to_port;
+  double delay_msecs;          // added to every connection
+  double jitter_msecs;         // uniformly distributed in [-jitter_msecs, jitter_msecs]
+  double loss_probability;     // frames lost silently after the sender saw a successful send
+  double refusal_probability;  // connections refused, the sender sees a failed send
+  double bandwidth;            // bytes per second, 0 for unlimited
+} LinkEmulation;
+
+typedef enum {
+  EMULATION_DELIVER,
+  EMULATION_LOSE,
+  EMULATION_REFUSE
+} EmulationVerdict;
+
+// delivers a delayed frame (or a piece of a stream), called by the delivery thread of its link, or
+// with cancelled set by emulation_cancel. either way it frees arg...
+typedef void (*EmulationDelivery)(void *arg, const int cancelled);
+
+
+int emulation_set_links(const unsigned n_links, const LinkEmulation links[n_links], const unsigned long seed);
+int emulation_load_links(const char *path, const unsigned long seed);
+
+int emulation_enabled(void);
+int emulation_matches(const int from_port, const int to_port);
+EmulationVerdict emulation_apply(const int from_port, const int to_port, const long frame_length,
+                                 long long *delay_usecs);
+
+int emulation_schedule(const int from_port, const int to_port, const long long delay_usecs, const long max_pending,
+                       const void *owner, const EmulationDelivery deliver, void *arg);
+void emulation_cancel(const void *owner);
+
+
+#endif
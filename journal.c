@@ -0,0 +1,342 @@
+/* journal.c
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#include "tinycthread.h"
+#include "journal.h"
+
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <sys/types.h>
+  #include <sys/stat.h>
+  #include <sys/mman.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+
+// record layout: state (1 byte), value type (1 byte), 2 unused bytes, data length (4 bytes),
+// priority (8 bytes), data padded to a multiple of 8 bytes, all in host byte order...
+static long record_length(const long data_length) {
+  return JOURNAL_RECORD_HEADER_LENGTH + (data_length + 7) / 8 * 8;
+}
+
+static long record_data_length(const char *record) {
+  uint32_t length;
+  memcpy(&length, record + 4, 4);
+  return (long) length;
+}
+
+#ifndef _WIN32
+static int map_journal(Journal *journal) {
+  void *base = mmap(NULL, journal->capacity, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0);
+  if (base == MAP_FAILED) {
+#ifdef NETISLANDS_DEBUG
+    perror("mmap");
+#endif
+    return EXIT_FAILURE;
+  }
+  journal->base = (char *) base;
+  return EXIT_SUCCESS;
+}
+#endif
+
+// find the end of the journal and count the live records...
+static void scan_journal(Journal *journal) {
+  long offset = JOURNAL_HEADER_LENGTH;
+  journal->n_live = 0;
+  journal->live_bytes = 0;
+  while (offset + JOURNAL_RECORD_HEADER_LENGTH <= journal->capacity
+         && journal->base[offset] != JOURNAL_RECORD_END) {
+    const long length = record_length(record_data_length(journal->base + offset));
+    if (offset + length > journal->capacity) { // torn record, ignore it and everything after it
+      break;
+    }
+    if (journal->base[offset] == JOURNAL_RECORD_LIVE) {
+      journal->n_live++;
+      journal->live_bytes += length;
+    }
+    offset += length;
+  }
+  journal->tail = offset;
+}
+
+int journal_open(Journal *journal, const char *path, const long capacity) {
+#ifdef _WIN32
+  (void) journal; (void) path; (void) capacity;
+  return EXIT_FAILURE; // memory-mapped journals are not supported on Windows yet
+#else
+  journal->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (journal->fd == -1) {
+#ifdef NETISLANDS_DEBUG
+    perror("open");
+#endif
+    return EXIT_FAILURE;
+  }
+  struct stat file_status;
+  if (fstat(journal->fd, &file_status) == -1) {
+    close(journal->fd);
+    return EXIT_FAILURE;
+  }
+  journal->path = (char *) malloc(strlen(path) + 1);
+  strcpy(journal->path, path);
+  const long file_size = (long) file_status.st_size;
+  journal->capacity = capacity > JOURNAL_MIN_CAPACITY ? capacity : JOURNAL_MIN_CAPACITY;
+  if (file_size > journal->capacity) {
+    journal->capacity = file_size;
+  }
+  if (file_size > 0 && file_size < JOURNAL_HEADER_LENGTH) {
+    close(journal->fd);
+    free(journal->path);
+    return EXIT_FAILURE; // not a journal
+  }
+  if (file_size < journal->capacity && ftruncate(journal->fd, journal->capacity) == -1) {
+#ifdef NETISLANDS_DEBUG
+    perror("ftruncate");
+#endif
+    close(journal->fd);
+    free(journal->path);
+    return EXIT_FAILURE;
+  }
+  if (map_journal(journal) == EXIT_FAILURE) {
+    close(journal->fd);
+    free(journal->path);
+    return EXIT_FAILURE;
+  }
+  if (file_size == 0) { // new journal
+    memcpy(journal->base, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC));
+  } else if (memcmp(journal->base, JOURNAL_MAGIC, strlen(JOURNAL_MAGIC)) != 0) {
+#ifdef NETISLANDS_DEBUG
+    fprintf(stderr, "journal_open: '%s' is not a netislands journal. (%s line# %d)\n", path, __FILE__, __LINE__);
+#endif
+    munmap(journal->base, journal->capacity);
+    close(journal->fd);
+    free(journal->path);
+    return EXIT_FAILURE;
+  }
+  scan_journal(journal);
+  return EXIT_SUCCESS;
+#endif
+}
+
+int journal_close(Journal *journal) {
+#ifndef _WIN32
+  msync(journal->base, journal->capacity, MS_SYNC);
+  munmap(journal->base, journal->capacity);
+  close(journal->fd);
+  free(journal->path);
+#endif
+  journal->base = NULL;
+  return EXIT_SUCCESS;
+}
+
+long journal_append(Journal *journal, const int state, const int type, const double priority,
+                    const char *data, const long length) {
+  const long offset = journal->tail;
+  const long new_tail = offset + record_length(length);
+  if (new_tail > journal->capacity) {
+    return -1; // journal full
+  }
+  char *record = journal->base + offset;
+  const uint32_t data_length = (uint32_t) length;
+  record[1] = (char) type;
+  record[2] = record[3] = 0;
+  memcpy(record + 4, &data_length, 4);
+  memcpy(record + 8, &priority, 8);
+  memcpy(record + JOURNAL_RECORD_HEADER_LENGTH, data, length);
+  // terminate the journal after the new record (stale bytes could look like a record after a
+  // crash), then publish the record by setting its state...
+  if (new_tail < journal->capacity) {
+    journal->base[new_tail] = JOURNAL_RECORD_END;
+  }
+  __atomic_store_n(record, (char) state, __ATOMIC_RELEASE);
+  journal->tail = new_tail;
+  if (state == JOURNAL_RECORD_LIVE) {
+    journal->n_live++;
+    journal->live_bytes += new_tail - offset;
+  }
+  return offset;
+}
+
+void journal_consume(Journal *journal, const long offset) {
+  char *record = journal->base + offset;
+  if (*record == JOURNAL_RECORD_LIVE) {
+    *record = JOURNAL_RECORD_CONSUMED;
+    journal->n_live--;
+    journal->live_bytes -= record_length(record_data_length(record));
+  }
+}
+
+void journal_for_each_live(const Journal *journal, const JournalRecordHandler handler, void *context) {
+  for (long offset = JOURNAL_HEADER_LENGTH; offset < journal->tail;
+       offset += record_length(record_data_length(journal->base + offset))) {
+    const char *record = journal->base + offset;
+    if (*record == JOURNAL_RECORD_LIVE) {
+      double priority;
+      memcpy(&priority, record + 8, 8);
+      handler(context, (unsigned char) record[1], priority, record + JOURNAL_RECORD_HEADER_LENGTH,
+              record_data_length(record));
+    }
+  }
+}
+
+void journal_reset(Journal *journal) {
+  memset(journal->base + JOURNAL_HEADER_LENGTH, 0, journal->tail - JOURNAL_HEADER_LENGTH);
+  journal->tail = JOURNAL_HEADER_LENGTH;
+  journal->n_live = 0;
+  journal->live_bytes = 0;
+}
+
+int journal_grow(Journal *journal, const long capacity) {
+#ifdef _WIN32
+  (void) journal; (void) capacity;
+  return EXIT_FAILURE;
+#else
+  if (capacity <= journal->capacity) {
+    return EXIT_SUCCESS;
+  }
+  if (ftruncate(journal->fd, capacity) == -1) {
+#ifdef NETISLANDS_DEBUG
+    perror("ftruncate");
+#endif
+    return EXIT_FAILURE;
+  }
+  // map the grown file before unmapping the old mapping, so that the journal stays usable on errors...
+  char *old_base = journal->base;
+  const long old_capacity = journal->capacity;
+  journal->capacity = capacity;
+  if (map_journal(journal) == EXIT_FAILURE) {
+    journal->capacity = old_capacity;
+    return EXIT_FAILURE;
+  }
+  munmap(old_base, old_capacity);
+  return EXIT_SUCCESS;
+#endif
+}
+
+// open an empty journal next to the given one, to be filled and then put in its place by
+// journal_replace...
+int journal_open_rewrite(const Journal *journal, Journal *rewrite) {
+#ifdef _WIN32
+  (void) journal; (void) rewrite;
+  return EXIT_FAILURE;
+#else
+  char *path = (char *) malloc(strlen(journal->path) + 5);
+  sprintf(path, "%s.tmp", journal->path);
+  unlink(path); // left over from an interrupted rewrite
+  const int ret = journal_open(rewrite, path, journal->capacity);
+  free(path);
+  return ret;
+#endif
+}
+
+// atomically rename the rewritten journal over the given one, so that a crash leaves one of them
+// complete. the rewrite is discarded on errors...
+int journal_replace(Journal *journal, Journal *rewrite) {
+#ifdef _WIN32
+  (void) journal; (void) rewrite;
+  return EXIT_FAILURE;
+#else
+  msync(rewrite->base, rewrite->capacity, MS_SYNC);
+  if (rename(rewrite->path, journal->path) == -1) {
+#ifdef NETISLANDS_DEBUG
+    perror("rename");
+#endif
+    unlink(rewrite->path);
+    journal_close(rewrite);
+    return EXIT_FAILURE;
+  }
+  munmap(journal->base, journal->capacity);
+  close(journal->fd);
+  free(rewrite->path);
+  rewrite->path = journal->path;
+  *journal = *rewrite;
+  return EXIT_SUCCESS;
+#endif
+}
+
+void journal_flush(Journal *journal) {
+#ifndef _WIN32
+  // write back asynchronously, the page cache already survives a crash of the process...
+  msync(journal->base, journal->capacity, MS_ASYNC);
+#else
+  (void) journal;
+#endif
+}
+
+#ifdef JOURNAL_TEST
+#define JOURNAL_TEST_PATH "journal_test.jrnl"
+
+static void test_print_record(void *context, const int type, const double priority,
+                              const char *data, const long length) {
+  (void) context;
+  printf("  type %d, priority %g: %.*s\n", type, priority, (int) length, data);
+}
+
+static void test_print_journal(const char *name, const Journal *journal) {
+  printf("%s: %ld live records (%ld bytes), tail at %ld:\n", name, journal->n_live, journal->live_bytes,
+         journal->tail);
+  journal_for_each_live(journal, &test_print_record, NULL);
+}
+
+int main() {
+  printf("Welcome to the Journal test program!\n");
+  unlink(JOURNAL_TEST_PATH);
+  Journal journal;
+  if (journal_open(&journal, JOURNAL_TEST_PATH, 0) == EXIT_FAILURE) {
+    printf("Cannot open '%s', exiting.\n", JOURNAL_TEST_PATH);
+    return EXIT_FAILURE;
+  }
+  const char *messages[4] = {"first", "second (consumed)", "third", "fourth (sent)"};
+  long offsets[4];
+  for (int i = 0; i < 4; i++) {
+    offsets[i] = journal_append(&journal, i == 3 ? JOURNAL_RECORD_SENT : JOURNAL_RECORD_LIVE, i, (double) i,
+                                messages[i], (long) strlen(messages[i]));
+  }
+  journal_consume(&journal, offsets[1]);
+  test_print_journal("Appended 4 records, consumed 1, 1 sent (expect first and third)", &journal);
+
+  // a crash before the state byte is set leaves a complete but unpublished record...
+  const long torn_offset = journal_append(&journal, JOURNAL_RECORD_LIVE, 0, 0.0, "unpublished", 11);
+  journal.base[torn_offset] = JOURNAL_RECORD_END;
+  journal_close(&journal);
+  if (journal_open(&journal, JOURNAL_TEST_PATH, 0) == EXIT_FAILURE) {
+    printf("Cannot reopen '%s', exiting.\n", JOURNAL_TEST_PATH);
+    return EXIT_FAILURE;
+  }
+  test_print_journal("Reopened after an unpublished append (expect first and third, tail 136)", &journal);
+  // a published record whose data runs past the end of the file is torn as well...
+  const uint32_t torn_length = (uint32_t) journal.capacity;
+  journal.base[journal.tail] = JOURNAL_RECORD_LIVE;
+  memcpy(journal.base + journal.tail + 4, &torn_length, 4);
+  journal_close(&journal);
+  journal_open(&journal, JOURNAL_TEST_PATH, 0);
+  test_print_journal("Reopened after a torn append (expect first and third, tail 136)", &journal);
+
+  // compact the live records into a temporary file and rename it over the journal...
+  Journal rewrite;
+  if (journal_open_rewrite(&journal, &rewrite) == EXIT_FAILURE) {
+    printf("Cannot open the rewrite of '%s', exiting.\n", JOURNAL_TEST_PATH);
+    return EXIT_FAILURE;
+  }
+  printf("Opened rewrite '%s'.\n", rewrite.path);
+  journal_append(&rewrite, JOURNAL_RECORD_LIVE, 2, 2.0, "third", 5);
+  if (journal_replace(&journal, &rewrite) == EXIT_FAILURE) {
+    printf("Cannot replace '%s', exiting.\n", JOURNAL_TEST_PATH);
+    return EXIT_FAILURE;
+  }
+  printf("Rewrite renamed over the journal: %s\n",
+         access(JOURNAL_TEST_PATH ".tmp", F_OK) == -1 ? "yes" : "no, temporary file left over");
+  test_print_journal("Compacted journal (expect third)", &journal);
+  journal_close(&journal);
+  journal_open(&journal, JOURNAL_TEST_PATH, 0);
+  test_print_journal("Reopened compacted journal (expect third, tail 40)", &journal);
+  journal_close(&journal);
+  unlink(JOURNAL_TEST_PATH);
+  printf("All done, exiting.\n");
+  return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,52 @@
+/* journal.h
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+
+#define JOURNAL_MAGIC "NIJRNL01"
+#define JOURNAL_HEADER_LENGTH 16 // magic and reserved bytes, records start after the header
+#define JOURNAL_RECORD_HEADER_LENGTH 16
+#define JOURNAL_MIN_CAPACITY 65536
+
+// record states, a record is written completely before its state is set...
+#define JOURNAL_RECORD_END 0        // no record here, end of the journal
+#define JOURNAL_RECORD_LIVE 'L'     // pending message
+#define JOURNAL_RECORD_CONSUMED 'C' // dequeued or dropped message
+#define JOURNAL_RECORD_SENT 'S'     // sent message, kept for the record only
+
+
+// an append-only file of message records, mapped into memory so that appending and consuming
+// records are plain memory writes...
+typedef struct Journal {
+  char *path;
+  int fd;
+  char *base;
+  long capacity; // size of the file and the mapping
+  long tail;     // offset of the next record
+  long n_live;
+  long live_bytes;
+} Journal;
+
+typedef void (*JournalRecordHandler)(void *context, const int type, const double priority,
+                                     const char *data, const long length);
+
+
+int journal_open(Journal *journal, const char *path, const long capacity);
+int journal_close(Journal *journal);
+
+long journal_append(Journal *journal, const int state, const int type, const double priority,
+                    const char *data, const long length);
+void journal_consume(Journal *journal, const long offset);
+
+void journal_for_each_live(const Journal *journal, const JournalRecordHandler handler, void *context);
+void journal_reset(Journal *journal);
+int journal_grow(Journal *journal, const long capacity);
+int journal_open_rewrite(const Journal *journal, Journal *rewrite);
+int journal_replace(Journal *journal, Journal *rewrite);
+void journal_flush(Journal *journal);
+
+
+#endif
@@ -3,9 +3,13 @@
  */
 
 #include "netislands.h"
+#include "resolver.h"
+#include "reactor.h"
+#include "journal.h"
+#include "emulation.h"
 
 #ifdef _WIN32
-  #define _WIN32_WINNT 0x501
+  #define _WIN32_WINNT 0x600 // WSAPoll
   #define _CRT_SECURE_NO_WARNINGS
   #include <winsock2.h>
   #include <ws2tcpip.h>
@@ -18,8 +22,13 @@
   #include <unistd.h>
   #include <netdb.h>
   #include <fcntl.h>
+  #include <poll.h>
+  #ifdef __linux__
+    #include <sys/eventfd.h>
+  #endif
   #include <sys/types.h>
   #include <sys/socket.h>
+  #include <sys/uio.h>
   #include <sys/time.h>
   #include <netinet/in.h>
   #include <netinet/tcp.h>
@@ -32,6 +41,7 @@
 #include <signal.h>
 #include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 
 #ifdef _WIN32
   #define close(a) closesocket(a)
@@ -44,6 +54,8 @@
   #undef  EWOULDBLOCK
   #define EWOULDBLOCK WSAEWOULDBLOCK
 
+  #define poll WSAPoll
+
   const char *inet_ntop(int af, const void *src, char *dst, socklen_t size) {
     union { struct sockaddr sa; struct sockaddr_in sai;
             struct sockaddr_in6 sai6; } addr;
@@ -64,17 +76,280 @@
 #define NETISLANDS_TAG_LENGTH 8
 #define NETISLANDS_JOIN_TAG "join---"
 #define NETISLANDS_DATA_TAG "data---"
-#define NETISLANDS_PROTOCOL_HEADER_LENGTH NETISLANDS_PROTOCOL_ID_LENGTH + NETISLANDS_PROTOCOL_VERSION_LENGTH + NETISLANDS_TAG_LENGTH
+#define NETISLANDS_FILL_TAG "fill---"
+#define NETISLANDS_XDATA_TAG "xdata--" // data message with extended header
+#define NETISLANDS_PING_TAG "ping---"
+#define NETISLANDS_PONG_TAG "pong---"
+#define NETISLANDS_STREAM_TAG "stream-" // followed by records until the connection is closed
+#define NETISLANDS_PING_LENGTH 12 // port (4 bytes) and timestamp (8 bytes), big-endian
+#define NETISLANDS_PULL_TAG "pull---" // request for messages, answered with data messages
+#define NETISLANDS_PULL_LENGTH 8 // port (4 bytes) and number of messages requested (4 bytes), big-endian
+#define NETISLANDS_SENDER_PORT_OFFSET (NETISLANDS_PROTOCOL_ID_LENGTH + NETISLANDS_PROTOCOL_VERSION_LENGTH + NETISLANDS_TAG_LENGTH)
+#define NETISLANDS_SENDER_PORT_LENGTH 4 // big-endian port of the sending island, rate limits tell islands on a host apart by it
+#define NETISLANDS_PROTOCOL_HEADER_LENGTH (NETISLANDS_SENDER_PORT_OFFSET + NETISLANDS_SENDER_PORT_LENGTH)
+
+// extended header flags, each flag set adds a field to the extended header (in flag order, except
+// for the values field, which is always last)...
+#define NETISLANDS_XDATA_PRIORITY 0x01 // 8 byte big-endian IEEE 754 double
+#define NETISLANDS_XDATA_VALUES 0x02 // value type, byte order ('b' or 'l'), padding length, padding
+#define NETISLANDS_XDATA_TIMING 0x04 // send time (8 bytes, usecs since epoch), origin port (4 bytes)
+#define NETISLANDS_XDATA_FORWARD 0x08 // origin id (8 bytes), sequence number (8 bytes), remaining hops (1 byte)
+#define NETISLANDS_VALUES_ALIGNMENT 8 // typed values start at a multiple of this offset in the frame
+#define NETISLANDS_MAX_XDATA_HEADER_LENGTH 64
+#define NETISLANDS_FRAME_SEGMENTS 5 // protocol id and version, tag, sender port, payload and values
+#define NETISLANDS_STREAM_RECORD_HEADER_LENGTH 4 // big-endian length of the record data, 0 ends the stream
+#ifdef _WIN32
+  #define NETISLANDS_STOP_CHECK_MSECS 50 // interval in which connects and sends notice a destroyed island (no stop fd)
+#endif
+
+// don't get killed by SIGPIPE when a receiver drops a connection...
+#ifdef MSG_NOSIGNAL
+  #define NETISLANDS_SEND_FLAGS MSG_NOSIGNAL
+#else
+  #define NETISLANDS_SEND_FLAGS 0
+#endif
+
+// a part of a frame for scatter-gather sends...
+#ifdef _WIN32
+  typedef WSABUF Segment;
+  #define SEGMENT_BASE(segment) ((segment).buf)
+  #define SEGMENT_LENGTH(segment) ((segment).len)
+#else
+  typedef struct iovec Segment;
+  #define SEGMENT_BASE(segment) ((segment).iov_base)
+  #define SEGMENT_LENGTH(segment) ((segment).iov_len)
+#endif
+
+
+typedef struct {
+  unsigned flags;
+  double priority;
+  Netislands_Value_Type value_type;
+  int big_endian;
+  long long timestamp;
+  int origin_port;
+  unsigned long long origin_id;
+  unsigned long forward_sequence;
+  unsigned ttl;
+} DataHeader;
+
+// a message to send, values (if any) are sent right after the payload without copying them...
+typedef struct {
+  const char *tag;
+  const char *payload;
+  long payload_length;
+  const char *values;
+  long values_length;
+  const Netislands_Island *island; // sending island
+} Frame;
+
+// how a queued frame is accounted for when it is sent...
+typedef enum {
+  OUTBOUND_DATA,    // data message, counted as sent or failed and towards its neighbor's failures
+  OUTBOUND_SERVED,  // reply to a pull request, counted as served or failed
+  OUTBOUND_CONTROL  // fill level advertisement or pong, best effort and not counted
+} OutboundKind;
+
+// a copy of a frame in the outbound queues of one or more neighbors, payload and values follow
+// each other in data...
+typedef struct {
+  int refcount;
+  OutboundKind kind;
+  const char *tag;
+  long payload_length;
+  long values_length;
+  char data[];
+} OutboundFrame;
 
+// a sender thread with its deque of neighbors that have frames to send. the owner takes neighbors
+// from the front, idle senders steal from the back...
+typedef struct {
+  const Netislands_Island *island;
+  thrd_t thread;
+  mtx_t mutex; // protects the deque, taken after the neighbor_queue lock if both are held
+  unsigned *neighbor_ids;
+  long head;
+  long length;
+  long capacity;
+} Sender;
+
+// outbound queues of an island's neighbors and the sender threads sending from them. the queues
+// are protected by the neighbor_queue lock, the deques by locks of their own, so that senders
+// taking and stealing neighbors do not contend for one lock...
+typedef struct Netislands_Outbound {
+  long capacity; // per neighbor
+  int data_queued; // data messages are queued, otherwise only frames sent in the background are
+  Netislands_Outbound_Policy policy;
+  int block_timeout_msecs;
+  Sender *senders;
+  unsigned n_senders;
+  unsigned n_started; // sender threads running, fewer than n_senders if the island failed to start
+  long n_scheduled; // neighbors in all deques, counted with __atomic operations like the fields below
+  unsigned n_idle; // senders waiting for frames_available
+  mtx_t idle_mutex; // held by senders going to wait for frames_available
+  cnd_t frames_available;
+  cnd_t space_available; // signalled with the neighbor_queue lock
+  int exit_flag;
+} Outbound;
+
+// a data frame on its way to the neighbors of an island...
+typedef struct {
+  const Frame *frame;
+  const Netislands_Island *island;
+  OutboundFrame *outbound_frame; // shared copy of frame if it is queued
+  int background; // queued even if data messages are sent synchronously, never waits for room
+  unsigned *blocked_ids; // neighbors with full outbound queues, for NETISLANDS_OUTBOUND_BLOCK
+  long n_blocked;
+  long blocked_capacity;
+  int remove_failed; // set if a synchronous send failed max_failures times
+} DataSend;
 
+// a message in the message queue...
 typedef struct {
-  char hostname[NETISLANDS_MAX_HOSTNAME_LENGTH];
+  Netislands_Message message;
+  double priority;
+  long journal_offset; // offset of the message's journal record, -1 if not journaled
+  long sender_id; // id of the sending neighbor if the message was timed, -1 otherwise
+  long long enqueue_usecs;
+} QueuedMessage;
+
+typedef struct Netislands_Neighbor {
+  char hostname[NETISLANDS_MAX_HOSTNAME_LENGTH]; // numeric IPv4 or IPv6 address
   int port;
-  unsigned failure_count;
+  struct sockaddr_storage address;
+  socklen_t address_length;
+  unsigned id;
+  unsigned failure_count; // counted with __atomic operations by senders not holding the neighbor_queue lock
+  int remote_fill_level; // message queue fill level advertised by this neighbor (per mille), __atomic like below
+  long long remote_fill_level_expiry;
+  long send_credit; // per mille of a send
+  int removed; // retired by remove_failed_neighbors, snapshot readers may still hold it
+  Netislands_Neighbor_Latency latency;
+  OutboundFrame **outbound_frames; // ring buffer of Outbound.capacity frames, NULL without outbound queues
+  long outbound_head;
+  long outbound_length;
+  long outbound_max_length;
+  unsigned long outbound_dropped;
+  int outbound_scheduled; // in a sender's deque or being sent, by one sender at a time to keep the frame order
+  unsigned long long retire_epoch;
+  struct Netislands_Neighbor *next_retired;
 } Neighbor;
 
+// an immutable copy of the neighbor index, senders read the current snapshot without holding the
+// neighbor_queue lock...
+typedef struct NeighborSnapshot {
+  long length;
+  unsigned long long retire_epoch;
+  struct NeighborSnapshot *next_retired;
+  Neighbor *neighbors[]; // ordered by id, like the index
+} NeighborSnapshot;
+
+// the published neighbor snapshot of an island, with epoch-based reclamation: a reader announces
+// the epoch it entered in a reader slot, a replaced snapshot (and the neighbors removed with it) is
+// retired with the epoch of its replacement and freed once no reader entered before that epoch...
+typedef struct Netislands_Neighbor_Snapshots {
+  NeighborSnapshot *current;
+  unsigned long long epoch;
+  unsigned long long reader_epochs[NETISLANDS_SNAPSHOT_READERS]; // 0 for free slots
+  NeighborSnapshot *retired_snapshots; // protected by the neighbor_queue lock, like retired_neighbors
+  Neighbor *retired_neighbors;
+} Snapshots;
+
+// join announcements to the neighbors of a new island, sent by up to parallelism threads taking
+// neighbors in turn...
+typedef struct Netislands_Join {
+  const Netislands_Island *island;
+  char message[NETISLANDS_MAX_PORT_STRING_LENGTH];
+  Neighbor *neighbors; // copies of the neighbors at the start of the join
+  int *failed;
+  long n_neighbors;
+  long next_neighbor; // taken with __atomic operations
+  unsigned parallelism;
+  unsigned retries;
+  int retry_msecs;
+  mtx_t mutex; // protects cancelled, retry delays wait on cancel
+  cnd_t cancel;
+  int cancelled;
+  thrd_t thread; // background join
+} Join;
+
+// a received piece of a stream, in a receive buffer taken over from the reactor...
+typedef struct StreamChunk {
+  char *data;
+  long length;
+  struct StreamChunk *next;
+} StreamChunk;
+
+// a stream sent to a neighbor over a connection of its own, or received from one. the fields of
+// incoming streams are protected by the mutex of the island's streams...
+struct Netislands_Stream {
+  const Netislands_Island *island;
+  int outgoing;
+  int sockfd; // of outgoing streams, -1 for incoming ones and until an emulated stream is connected
+  int failed; // set with __atomic operations, by the delivery thread of emulated streams
+  int target_port; // of outgoing streams
+  int emulated; // outgoing stream over an emulated link, connected and written by its delivery thread
+  int lost; // outgoing stream lost by link emulation, its data is dropped
+  long pending_bytes; // of emulated streams, not delivered yet
+  StreamChunk *chunks; // received data not read yet
+  StreamChunk *last_chunk;
+  long read_offset; // in the first chunk
+  long buffered_bytes; // received data not read yet
+  int paused; // the reactor stopped reading, until the reader has caught up with half the window
+  char record_header[NETISLANDS_STREAM_RECORD_HEADER_LENGTH]; // may be split over two chunks
+  int record_header_length;
+  unsigned long record_remaining; // data bytes of the current record still to receive
+  int end_received; // end record received, the stream is complete
+  int connected; // the reactor still delivers data
+  int accepted;
+  int closed; // by the reader
+  struct Netislands_Stream *next;
+};
+
+// the incoming streams of an island, in order of arrival...
+typedef struct Netislands_Streams {
+  mtx_t mutex;
+  cnd_t data_available;
+  cnd_t delivered; // signalled when data of an emulated outgoing stream has been delivered
+  Netislands_Stream *incoming;
+} Streams;
+
+// messages offered to neighbors that pull them, from the outbox first and then from the provider...
+typedef struct Netislands_Pull {
+  mtx_t mutex; // protects the outbox and the provider
+  Queue outbox; // of Netislands_Message
+  long outbox_capacity; // 0 for unlimited
+  long outbox_bytes;
+  Netislands_Provider provider; // NULL without provider
+  void *provider_context;
+} Pull;
+
+// mutable counters and flags of an island, kept apart so that they can be updated through const
+// islands...
+typedef struct Netislands_Counters {
+  long message_queue_bytes; // values of the queued messages, protected by the message_queue lock
+  unsigned long next_sequence; // of forwarded data messages
+  int stopping; // set by island_destroy to break off connects and sends, read with __atomic operations
+  int stop_fds[2]; // eventfd (both ends) or self-pipe, readable once stopping is set, -1 on Windows
+} Counters;
+
 
 static int n_islands = 0;
+static mtx_t netislands_mutex; // protects the process-wide state below
+static once_flag netislands_mutex_once = ONCE_FLAG_INIT;
+static unsigned shared_reactor_threads = 0; // 0 if islands get their own reactor thread
+static Reactor *shared_reactor = NULL;
+static long n_shared_reactor_islands = 0;
+
+static FILE *capture_file = NULL; // traffic capture of all islands, protected by capture_mutex
+static int capturing = 0;
+static long long capture_start_usecs;
+static mtx_t capture_mutex;
+
+static void netislands_mutex_init(void) {
+  mtx_init(&netislands_mutex, mtx_plain);
+  mtx_init(&capture_mutex, mtx_plain);
+}
 
 static void netislands_init() {
 #ifdef _WIN32
@@ -88,43 +363,298 @@ static void netislands_init() {
 }
 
 static void netislands_shutdown() {
+  // the resolver cache is process-wide, drop it with the last island...
+  resolver_clear_cache();
 #ifdef _WIN32
   WSACleanup();
 #endif
 }
 
-static int receive_until_close(int connfd, char *message_buf, const long message_buf_size, long *message_length) {
-  struct sockaddr_in client_address;
-  socklen_t client_address_length = sizeof(client_address);
-  long message_buf_remaining = message_buf_size; 
-  char *message_buf_pos = message_buf;
-  for (;;) {
-    ssize_t bytes_received = recvfrom(connfd, message_buf_pos, message_buf_remaining, 0,
-                                      (struct sockaddr *)&client_address, &client_address_length);
-    if (bytes_received < 0) {
-#ifdef NETISLANDS_DEBUG
-      perror("recvfrom");
+static unsigned n_processors() {
+#ifdef _WIN32
+  SYSTEM_INFO system_info;
+  GetSystemInfo(&system_info);
+  return (unsigned) system_info.dwNumberOfProcessors;
+#else
+  const long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (unsigned) n : 1;
 #endif
-      // TODO maybe close connfd after error?
-      return EXIT_FAILURE;
-    } else if (bytes_received == 0) {
-      // TODO client closes connection?
-      if (close(connfd) == -1) {
-#ifdef NETISLANDS_DEBUG
-        perror("receive_until_close: close connfd");
+}
+
+static long long monotonic_usecs() {
+#ifdef _WIN32
+  return (long long) GetTickCount() * 1000;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
 #endif
-        //return EXIT_FAILURE;
-        return EXIT_SUCCESS; // ignore error
-      }
-      return EXIT_SUCCESS;
-    } else {
-      message_buf_pos += bytes_received;
-      message_buf_remaining -= bytes_received;
-      *message_length += bytes_received;
+}
+
+static long long realtime_usecs() {
+#ifdef _WIN32
+  FILETIME now; // 100 nanosecond intervals since 1601
+  GetSystemTimeAsFileTime(&now);
+  return (long long) ((((unsigned long long) now.dwHighDateTime << 32) | now.dwLowDateTime) / 10)
+    - 11644473600000000LL;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+static long long monotonic_msecs() {
+#ifdef _WIN32
+  return (long long) GetTickCount();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+static void encode_uint64(const uint64_t value, char *buf) {
+  for (int i = 0; i < 8; i++) {
+    buf[i] = (char) ((value >> (56 - 8 * i)) & 0xff);
+  }
+}
+
+static void encode_uint32(const uint32_t value, char *buf) {
+  for (int i = 0; i < 4; i++) {
+    buf[i] = (char) ((value >> (24 - 8 * i)) & 0xff);
+  }
+}
+
+static uint32_t decode_uint32(const char *buf) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value = (value << 8) | (unsigned char) buf[i];
+  }
+  return value;
+}
+
+static uint64_t decode_uint64(const char *buf) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value = (value << 8) | (unsigned char) buf[i];
+  }
+  return value;
+}
+
+static void encode_double(const double value, char *buf) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  encode_uint64(bits, buf);
+}
+
+static double decode_double(const char *buf) {
+  const uint64_t bits = decode_uint64(buf);
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static int host_is_big_endian() {
+  const uint16_t one = 1;
+  return *(const unsigned char *) &one == 0;
+}
+
+static long value_size(const Netislands_Value_Type type) {
+  switch (type) {
+  case NETISLANDS_VALUES_BYTES: return 1;
+  case NETISLANDS_VALUES_F64: return 8;
+  case NETISLANDS_VALUES_F32: return 4;
+  case NETISLANDS_VALUES_I32: return 4;
+  case NETISLANDS_VALUES_I64: return 8;
+  }
+  return 0; // unknown value type
+}
+
+static void swap_value_bytes(char *values, const long n_values, const long size) {
+  for (long i = 0; i < n_values; i++) {
+    char *value = values + i * size;
+    for (long j = 0; j < size / 2; j++) {
+      const char tmp = value[j];
+      value[j] = value[size - 1 - j];
+      value[size - 1 - j] = tmp;
+    }
+  }
+}
+
+static void init_data_header(DataHeader *header, const unsigned flags) {
+  header->flags = flags;
+  header->priority = 0.0;
+  header->value_type = NETISLANDS_VALUES_BYTES;
+  header->big_endian = host_is_big_endian();
+  header->timestamp = 0;
+  header->origin_port = 0;
+  header->origin_id = 0;
+  header->forward_sequence = 0;
+  header->ttl = 0;
+}
+
+static long encode_data_header(const DataHeader *header, char *buf) {
+  long length = 0;
+  buf[length++] = (char) header->flags;
+  if (header->flags & NETISLANDS_XDATA_PRIORITY) {
+    encode_double(header->priority, buf + length);
+    length += 8;
+  }
+  if (header->flags & NETISLANDS_XDATA_TIMING) {
+    encode_uint64((uint64_t) header->timestamp, buf + length);
+    encode_uint32((uint32_t) header->origin_port, buf + length + 8);
+    length += 12;
+  }
+  if (header->flags & NETISLANDS_XDATA_FORWARD) {
+    encode_uint64((uint64_t) header->origin_id, buf + length);
+    encode_uint64((uint64_t) header->forward_sequence, buf + length + 8);
+    buf[length + 16] = (char) header->ttl;
+    length += 17;
+  }
+  if (header->flags & NETISLANDS_XDATA_VALUES) {
+    // pad the header so that the values following it are aligned in the receive buffer...
+    const long padding = (NETISLANDS_VALUES_ALIGNMENT
+                          - (NETISLANDS_PROTOCOL_HEADER_LENGTH + length + 3) % NETISLANDS_VALUES_ALIGNMENT)
+      % NETISLANDS_VALUES_ALIGNMENT;
+    buf[length++] = (char) header->value_type;
+    buf[length++] = header->big_endian ? 'b' : 'l';
+    buf[length++] = (char) padding;
+    memset(buf + length, 0, padding);
+    length += padding;
+  }
+  return length;
+}
+
+static long decode_data_header(const char *buf, const long buf_length, DataHeader *header) {
+  long length = 0;
+  if (buf_length < 1) {
+    return -1;
+  }
+  init_data_header(header, (unsigned char) buf[length++]);
+  if (header->flags & NETISLANDS_XDATA_PRIORITY) {
+    if (buf_length < length + 8) {
+      return -1;
+    }
+    header->priority = decode_double(buf + length);
+    length += 8;
+  }
+  if (header->flags & NETISLANDS_XDATA_TIMING) {
+    if (buf_length < length + 12) {
+      return -1;
+    }
+    header->timestamp = (long long) decode_uint64(buf + length);
+    header->origin_port = (int) decode_uint32(buf + length + 8);
+    length += 12;
+  }
+  if (header->flags & NETISLANDS_XDATA_FORWARD) {
+    if (buf_length < length + 17) {
+      return -1;
+    }
+    header->origin_id = (unsigned long long) decode_uint64(buf + length);
+    header->forward_sequence = (unsigned long) decode_uint64(buf + length + 8);
+    header->ttl = (unsigned char) buf[length + 16];
+    length += 17;
+  }
+  if (header->flags & NETISLANDS_XDATA_VALUES) {
+    if (buf_length < length + 3) {
+      return -1;
+    }
+    header->value_type = (Netislands_Value_Type) (unsigned char) buf[length];
+    header->big_endian = buf[length + 1] == 'b';
+    const long padding = (unsigned char) buf[length + 2];
+    length += 3 + padding;
+    if (value_size(header->value_type) == 0 || buf_length < length) {
+      return -1;
     }
   }
-  fprintf(stderr, "netislands internal error. (%s line# %d)\n", __FILE__, __LINE__);
-  return EXIT_FAILURE; // we should never end up here
+  return length;
+}
+
+static void init_neighbor(Neighbor *neighbor, const int port) {
+  neighbor->port = port;
+  neighbor->id = 0;
+  neighbor->failure_count = 0;
+  neighbor->remote_fill_level = 0;
+  neighbor->remote_fill_level_expiry = 0;
+  neighbor->send_credit = 0;
+  neighbor->removed = 0;
+  memset(&neighbor->latency, 0, sizeof(Netislands_Neighbor_Latency));
+  neighbor->outbound_frames = NULL;
+  neighbor->outbound_head = 0;
+  neighbor->outbound_length = 0;
+  neighbor->outbound_max_length = 0;
+  neighbor->outbound_dropped = 0;
+  neighbor->outbound_scheduled = 0;
+  neighbor->retire_epoch = 0;
+  neighbor->next_retired = NULL;
+}
+
+// copy what it takes to send to a neighbor, without its counters that other senders update...
+static void copy_neighbor_address(Neighbor *copy, const Neighbor *neighbor) {
+  init_neighbor(copy, neighbor->port);
+  strcpy(copy->hostname, neighbor->hostname);
+  memcpy(&copy->address, &neighbor->address, sizeof(struct sockaddr_storage));
+  copy->address_length = neighbor->address_length;
+  copy->id = neighbor->id;
+}
+
+static void latency_histogram_add(Netislands_Latency_Histogram *histogram, const long long usecs) {
+  int bucket = 0;
+  for (long long rest = usecs; rest > 1 && bucket < NETISLANDS_LATENCY_BUCKETS - 1; rest >>= 1) {
+    bucket++;
+  }
+  histogram->counts[bucket]++;
+  if (histogram->n == 0 || usecs < histogram->min_usecs) {
+    histogram->min_usecs = usecs; // may be negative for one way latencies if clocks are off
+  }
+  if (histogram->n == 0 || usecs > histogram->max_usecs) {
+    histogram->max_usecs = usecs;
+  }
+  histogram->n++;
+  histogram->sum_usecs += usecs;
+}
+
+// init the socket address of a neighbor from its numeric hostname...
+static int init_neighbor_address(Neighbor *neighbor) {
+  struct addrinfo hints, *results;
+  char port_string[NETISLANDS_MAX_PORT_STRING_LENGTH];
+  sprintf(port_string, "%d", neighbor->port);
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+  if (getaddrinfo(neighbor->hostname, port_string, &hints, &results) != 0) {
+    return EXIT_FAILURE;
+  }
+  memcpy(&neighbor->address, results->ai_addr, results->ai_addrlen);
+  neighbor->address_length = (socklen_t) results->ai_addrlen;
+  freeaddrinfo(results);
+  return EXIT_SUCCESS;
+}
+
+// init hostname and socket address of a neighbor from the address of a client connected to our
+// (dual-stack) server socket, mapping IPv4-mapped IPv6 addresses back to IPv4...
+static void init_neighbor_address_from_client(Neighbor *neighbor, const struct sockaddr_storage *client_address) {
+  const struct sockaddr_in6 *client_address6 = (const struct sockaddr_in6 *) client_address;
+  if (client_address->ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&client_address6->sin6_addr)) {
+    struct sockaddr_in *address = (struct sockaddr_in *) &neighbor->address;
+    memset(address, 0, sizeof(struct sockaddr_in));
+    address->sin_family = AF_INET;
+    memcpy(&address->sin_addr, client_address6->sin6_addr.s6_addr + 12, 4);
+    neighbor->address_length = sizeof(struct sockaddr_in);
+  } else {
+    memcpy(&neighbor->address, client_address, sizeof(struct sockaddr_storage));
+    neighbor->address_length = client_address->ss_family == AF_INET6
+      ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+  }
+  if (neighbor->address.ss_family == AF_INET6) {
+    ((struct sockaddr_in6 *) &neighbor->address)->sin6_port = htons(neighbor->port);
+  } else {
+    ((struct sockaddr_in *) &neighbor->address)->sin_port = htons(neighbor->port);
+  }
+  getnameinfo((struct sockaddr *) &neighbor->address, neighbor->address_length,
+              neighbor->hostname, NETISLANDS_MAX_HOSTNAME_LENGTH, NULL, 0, NI_NUMERICHOST);
 }
 
 static int check_netislands_message(const char *message, const long message_length) {
@@ -154,289 +684,1913 @@ static int neighbor_equal_predicate(const void *a, const void *b) {
   }
 }
 
-static int island_thread_main(void *args) {
-  Netislands_Island *island = (Netislands_Island*) args;
-  int listenfd, connfd;
-  fd_set fd_read_set;
-  socklen_t client_address_length;
-
-  if ((listenfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == -1) {
-#ifdef NETISLANDS_DEBUG
-    perror("socket");
-#endif
-    return EXIT_FAILURE;
+static OutboundFrame *new_outbound_frame(const Frame *frame, const OutboundKind kind) {
+  OutboundFrame *outbound_frame = (OutboundFrame *) malloc(sizeof(OutboundFrame) + frame->payload_length
+                                                           + frame->values_length);
+  outbound_frame->refcount = 1;
+  outbound_frame->kind = kind;
+  outbound_frame->tag = frame->tag;
+  outbound_frame->payload_length = frame->payload_length;
+  outbound_frame->values_length = frame->values_length;
+  memcpy(outbound_frame->data, frame->payload, frame->payload_length);
+  if (frame->values_length > 0) {
+    memcpy(outbound_frame->data + frame->payload_length, frame->values, frame->values_length);
   }
-  // allow socket address reuse to avoid "address alreay in use" errors...
-  int option_value = 1;
-  setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &option_value, sizeof option_value);
+  return outbound_frame;
+}
 
-  struct sockaddr_in server_address;
-  memset((char *) &server_address, 0, sizeof(server_address));
-  server_address.sin_family = AF_INET;
-  server_address.sin_addr.s_addr = htonl(INADDR_ANY);
-  server_address.sin_port = htons(island->port);
-  struct timeval select_timeout = {0, 500000}; // 0.5sec
-  if (bind(listenfd, (struct sockaddr *)&server_address, sizeof(server_address)) == -1) {
-#ifdef NETISLANDS_DEBUG
-    perror("bind");
-#endif
-    return EXIT_FAILURE;
+static void release_outbound_frame(OutboundFrame *outbound_frame) {
+  if (__atomic_sub_fetch(&outbound_frame->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+    free(outbound_frame);
   }
-  if (listen(listenfd, NETISLANDS_BACKLOG) == -1) {
-#ifdef NETISLANDS_DEBUG
-    perror("listen");
-#endif
-    return EXIT_FAILURE;
+}
+
+static OutboundFrame *neighbor_dequeue_frame(const Netislands_Island *island, Neighbor *neighbor) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  OutboundFrame *outbound_frame = neighbor->outbound_frames[neighbor->outbound_head];
+  neighbor->outbound_head = (neighbor->outbound_head + 1) % island->outbound->capacity;
+  neighbor->outbound_length--;
+  cnd_broadcast(&island->outbound->space_available);
+  return outbound_frame;
+}
+
+static void sender_push(Sender *sender, const unsigned neighbor_id) {
+  mtx_lock(&sender->mutex);
+  if (sender->length == sender->capacity) {
+    const long new_capacity = sender->capacity ? 2 * sender->capacity : 16;
+    unsigned *neighbor_ids = (unsigned *) malloc(new_capacity * sizeof(unsigned));
+    for (long i = 0; i < sender->length; i++) {
+      neighbor_ids[i] = sender->neighbor_ids[(sender->head + i) % sender->capacity];
+    }
+    free(sender->neighbor_ids);
+    sender->neighbor_ids = neighbor_ids;
+    sender->head = 0;
+    sender->capacity = new_capacity;
   }
-#ifdef NETISLANDS_DEBUG
-  fprintf(stderr, "Server socket bound to port %d. Listening for a TCP connection...\n",
-          island->port);
-#endif
+  sender->neighbor_ids[(sender->head + sender->length) % sender->capacity] = neighbor_id;
+  sender->length++;
+  mtx_unlock(&sender->mutex);
+  __atomic_add_fetch(&sender->island->outbound->n_scheduled, 1, __ATOMIC_SEQ_CST);
+}
 
-  while (!island->exit_flag) {
-    FD_ZERO(&fd_read_set);
-    FD_SET(listenfd, &fd_read_set);
-    int select_ret = select(listenfd + 1, &fd_read_set, 0, 0, &select_timeout);
-    if (select_ret == -1) {
-#ifdef NETISLANDS_DEBUG
-      perror("select");
-#endif
-      return EXIT_FAILURE;
+// take a neighbor from the front of a sender's own deque, or steal one from the back of another
+// sender's deque. only one deque lock is held at a time...
+static int sender_take(Sender *sender, unsigned *neighbor_id) {
+  int ret = EXIT_FAILURE;
+  mtx_lock(&sender->mutex);
+  if (sender->length > 0) {
+    *neighbor_id = sender->neighbor_ids[sender->head];
+    sender->head = (sender->head + 1) % sender->capacity;
+    sender->length--;
+    ret = EXIT_SUCCESS;
+  }
+  mtx_unlock(&sender->mutex);
+  Outbound *outbound = sender->island->outbound;
+  for (unsigned i = 0; i < outbound->n_senders && ret == EXIT_FAILURE; i++) {
+    Sender *victim = &outbound->senders[i];
+    if (victim == sender) {
+      continue;
     }
-    if (select_ret > 0) {
-      struct sockaddr_in client_address;
-      client_address_length = sizeof(client_address);
-      if ((connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_address_length)) == -1) {
-#ifdef NETISLANDS_DEBUG
-        perror("accept");
-#endif
-        return EXIT_FAILURE;
-      }
-#ifdef NETISLANDS_DEBUG
-      fprintf(stderr, "+ Server accepted a connection.\n");
-#endif
-      long message_length = 0;
-      if (receive_until_close(connfd, island->message_buffer, NETISLANDS_SERVER_BUFFER_LENGTH, &message_length) == EXIT_FAILURE) {
-#ifdef NETISLANDS_DEBUG
-        fprintf(stderr, "Network error while receiving netislands message, ignoring message. (%s line# %d)\n", __FILE__, __LINE__);
-#endif
-        continue;
-      }
-      
-      if (check_netislands_message(island->message_buffer, message_length) == EXIT_FAILURE) {
-#ifdef NETISLANDS_DEBUG
-        fprintf(stderr, "Received malformed netislands message, ignoring. (%s line# %d)\n", __FILE__, __LINE__);
-#endif
-        continue;
-      }
-      char tag[NETISLANDS_TAG_LENGTH];
-      strncpy(tag, island->message_buffer + NETISLANDS_PROTOCOL_ID_LENGTH + NETISLANDS_PROTOCOL_VERSION_LENGTH, NETISLANDS_TAG_LENGTH); 
-
-      // handle message based on message tag...
-      if (strcmp(NETISLANDS_DATA_TAG, tag) == 0) { // data message
-        // if the maximum message queue length is not exceeded, allocate memory
-        // and store the received data message content in the islands message_queue,
-        // otherwise drop an old message first...
-        mtx_lock(island->message_queue_mutex);
-        if (island->max_message_queue_length != 0
-            && queue_length(island->message_queue) >= island->max_message_queue_length) {
-          char *message_to_drop;
-          queue_dequeue(island->message_queue, (void **) &message_to_drop);
-          free(message_to_drop);
-        }
-        char *new_message = (char *) malloc(message_length - NETISLANDS_PROTOCOL_HEADER_LENGTH);
-        strncpy(new_message, island->message_buffer + NETISLANDS_PROTOCOL_HEADER_LENGTH, message_length - NETISLANDS_PROTOCOL_HEADER_LENGTH);
-        queue_enqueue(island->message_queue, new_message);
-        mtx_unlock(island->message_queue_mutex);
-      } else if (strcmp(NETISLANDS_JOIN_TAG, tag) == 0) { // join message
-        // create and initialize new neighbor...
-        Neighbor *new_neighbor = (Neighbor *) malloc(sizeof(Neighbor));
-        inet_ntop(AF_INET, &(client_address.sin_addr), new_neighbor->hostname, NETISLANDS_MAX_HOSTNAME_LENGTH);
-        char port_string[NETISLANDS_MAX_PORT_STRING_LENGTH];
-        strncpy(port_string, island->message_buffer + NETISLANDS_PROTOCOL_HEADER_LENGTH, 8);
-        new_neighbor->port = atoi(port_string);  
-        new_neighbor->failure_count = 0;
-        // check if the new neighbor is already in the neighbor queue...
-        mtx_lock(island->neighbor_queue_mutex);
-        long new_neighbor_index = queue_first_index_of(island->neighbor_queue, new_neighbor, &neighbor_equal_predicate); 
-        if (new_neighbor_index == -1) { // unknown new neighbor, add it to the queue...
-          queue_enqueue(island->neighbor_queue, new_neighbor);
-        } else { // known new neighbor, reset its failure count...
-          free(new_neighbor);
-          Neighbor *known_neighbor;
-          queue_get_index(island->neighbor_queue, new_neighbor_index, (void **) &known_neighbor);
-          known_neighbor->failure_count = 0;
-        }
-        mtx_unlock(island->neighbor_queue_mutex);
-      } else { // unknown message tag
-#ifdef NETISLANDS_DEBUG
-        fprintf(stderr, "Received netislands message with unknown tag '%s', ignoring. (%s line# %d)\n", tag, __FILE__, __LINE__);
-#endif
-        continue;
-      }
+    mtx_lock(&victim->mutex);
+    if (victim->length > 0) {
+      victim->length--;
+      *neighbor_id = victim->neighbor_ids[(victim->head + victim->length) % victim->capacity];
+      ret = EXIT_SUCCESS;
     }
+    mtx_unlock(&victim->mutex);
   }
-#ifdef NETISLANDS_DEBUG
-  fprintf(stderr, "Island server thread clean exit.\n");
-#endif
-  if (close(listenfd) == -1) {
-#ifdef NETISLANDS_DEBUG
-    perror("island_thread_main: close listenfd");
-#endif
-    return EXIT_FAILURE;
+  if (ret == EXIT_SUCCESS) {
+    __atomic_sub_fetch(&outbound->n_scheduled, 1, __ATOMIC_SEQ_CST);
   }
+  return ret;
+}
 
-  return EXIT_SUCCESS;
+// wait until a neighbor is scheduled or the senders stop. schedule_neighbor only takes the idle lock
+// if a sender waits, it sees either our n_idle or we see its n_scheduled...
+static void sender_wait(Outbound *outbound) {
+  mtx_lock(&outbound->idle_mutex);
+  __atomic_add_fetch(&outbound->n_idle, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&outbound->n_scheduled, __ATOMIC_SEQ_CST) == 0
+         && !__atomic_load_n(&outbound->exit_flag, __ATOMIC_SEQ_CST)) {
+    cnd_wait(&outbound->frames_available, &outbound->idle_mutex);
+  }
+  __atomic_sub_fetch(&outbound->n_idle, 1, __ATOMIC_SEQ_CST);
+  mtx_unlock(&outbound->idle_mutex);
 }
 
-static int send_all(const int sockfd, const char *message, const long message_length) {
-  long remaining = message_length;
-  char *message_pos = (char *) message;
-  while (remaining > 0) {
-    ssize_t bytes_send = send(sockfd, message_pos, remaining, 0);
-    if (bytes_send < 0) {
-#ifdef NETISLANDS_DEBUG
-      perror("send");
-#endif
+// hand a neighbor with queued frames to a sender, neighbors stick to one sender unless stolen...
+static void schedule_neighbor(const Netislands_Island *island, Neighbor *neighbor) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  Outbound *outbound = island->outbound;
+  neighbor->outbound_scheduled = 1;
+  sender_push(&outbound->senders[neighbor->id % outbound->n_senders], neighbor->id);
+  if (__atomic_load_n(&outbound->n_idle, __ATOMIC_SEQ_CST) > 0) {
+    mtx_lock(&outbound->idle_mutex);
+    cnd_signal(&outbound->frames_available);
+    mtx_unlock(&outbound->idle_mutex);
+  }
+}
+
+// queue a frame for a neighbor, returns EXIT_FAILURE if its queue is full and the island blocks.
+// frames that may not block are dropped instead...
+static int neighbor_enqueue_frame(const Netislands_Island *island, Neighbor *neighbor, OutboundFrame *outbound_frame,
+                                  const int may_block) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  Outbound *outbound = island->outbound;
+  if (neighbor->outbound_length == outbound->capacity) {
+    if (outbound->policy == NETISLANDS_OUTBOUND_BLOCK && may_block) {
       return EXIT_FAILURE;
-    } else if (bytes_send == 0) {
-#ifdef NETISLANDS_DEBUG
-      fprintf(stderr, "Socket closed by receiving neighbor, ignoring. (%s line# %d)\n", __FILE__, __LINE__);
-#endif
-      break; // socket closed by server
-    } else {
-      message_pos += bytes_send;
-      remaining -= bytes_send;
     }
+    neighbor->outbound_dropped++;
+    __atomic_fetch_add(&island->stats->outbound_dropped, 1, __ATOMIC_RELAXED);
+    if (outbound->policy != NETISLANDS_OUTBOUND_DROP_OLDEST) {
+      return EXIT_SUCCESS;
+    }
+    release_outbound_frame(neighbor_dequeue_frame(island, neighbor)); // NETISLANDS_OUTBOUND_DROP_OLDEST
+  }
+  __atomic_fetch_add(&outbound_frame->refcount, 1, __ATOMIC_RELAXED);
+  neighbor->outbound_frames[(neighbor->outbound_head + neighbor->outbound_length) % outbound->capacity] = outbound_frame;
+  neighbor->outbound_length++;
+  if (neighbor->outbound_length > neighbor->outbound_max_length) {
+    neighbor->outbound_max_length = neighbor->outbound_length;
+  }
+  if (!neighbor->outbound_scheduled) {
+    schedule_neighbor(island, neighbor);
   }
   return EXIT_SUCCESS;
 }
 
-static int connect_send_close(const char *hostname, const int port, const char *tag, const char *message, const long message_length) {
-  struct sockaddr_in server_address;
-  memset((char *) &server_address, 0, sizeof(server_address));
-  server_address.sin_family = AF_INET;
-  server_address.sin_addr.s_addr = inet_addr(hostname); // hostname has to be in x.x.x.x format
-  server_address.sin_port = htons(port);
+static void free_neighbor(const Netislands_Island *island, Neighbor *neighbor) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  while (neighbor->outbound_length > 0) {
+    release_outbound_frame(neighbor_dequeue_frame(island, neighbor));
+  }
+  free(neighbor->outbound_frames);
+  free(neighbor);
+}
 
-  int sockfd, connfd;
+static long neighbor_index_position(const Netislands_Neighbor_Index *index, const unsigned id) {
+  long low = 0, high = index->length - 1;
+  while (low <= high) {
+    const long middle = low + (high - low) / 2;
+    if (index->neighbors[middle]->id == id) {
+      return middle;
+    } else if (index->neighbors[middle]->id < id) {
+      low = middle + 1;
+    } else {
+      high = middle - 1;
+    }
+  }
+  return -1;
+}
 
-  // create client socket and connect to neighbor...
-  if ((sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == -1) {
-#ifdef NETISLANDS_DEBUG
-    perror("socket");
-#endif
-    return EXIT_FAILURE;
+static void free_retired_snapshots(const Netislands_Island *island) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  Snapshots *snapshots = island->snapshots;
+  unsigned long long min_epoch = ~0ULL;
+  for (int i = 0; i < NETISLANDS_SNAPSHOT_READERS; i++) {
+    const unsigned long long reader_epoch = __atomic_load_n(&snapshots->reader_epochs[i], __ATOMIC_SEQ_CST);
+    if (reader_epoch != 0 && reader_epoch < min_epoch) {
+      min_epoch = reader_epoch;
+    }
   }
-  if ((connfd = connect(sockfd, (struct sockaddr *)&server_address, sizeof(server_address))) == -1) { // TODO use select for timeouts
-#ifdef NETISLANDS_DEBUG
-    perror("connect");
-#endif
-    return EXIT_FAILURE;
+  // the retired lists are ordered by decreasing epoch...
+  NeighborSnapshot **snapshot = &snapshots->retired_snapshots;
+  while (*snapshot != NULL && (*snapshot)->retire_epoch > min_epoch) {
+    snapshot = &(*snapshot)->next_retired;
   }
-
-  // send message protocol header and protocol version...
-  if (send_all(sockfd, NETISLANDS_PROTOCOL_ID NETISLANDS_PROTOCOL_VERSION,
-               NETISLANDS_PROTOCOL_ID_LENGTH + NETISLANDS_PROTOCOL_VERSION_LENGTH) == EXIT_FAILURE) {
-    return EXIT_FAILURE;
+  while (*snapshot != NULL) {
+    NeighborSnapshot *next = (*snapshot)->next_retired;
+    free(*snapshot);
+    *snapshot = next;
   }
-  // send message tag...
-  if (send_all(sockfd, tag, NETISLANDS_TAG_LENGTH) == EXIT_FAILURE) {
-    return EXIT_FAILURE;
+  Neighbor **neighbor = &snapshots->retired_neighbors;
+  while (*neighbor != NULL && (*neighbor)->retire_epoch > min_epoch) {
+    neighbor = &(*neighbor)->next_retired;
   }
-  // send message data...
-  if (send_all(sockfd, message, message_length) == EXIT_FAILURE) {
-    return EXIT_FAILURE;
+  while (*neighbor != NULL) {
+    Neighbor *next = (*neighbor)->next_retired;
+    free_neighbor(island, *neighbor);
+    *neighbor = next;
   }
+}
 
-  // close connection...
-  /*
-  // TODO does connfd need to be closed?
-  if (close(connfd) == -1) {
-//#ifdef NETISLANDS_DEBUG
-    perror("connect_send_close: close connfd");
-//#endif
-    //return EXIT_FAILURE;
-    return EXIT_SUCCESS; // ignore error
+// replace the published snapshot by a copy of the neighbor index, returns the epoch in which the
+// old snapshot is retired...
+static unsigned long long island_publish_snapshot(const Netislands_Island *island) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  const Netislands_Neighbor_Index *index = island->neighbor_index;
+  Snapshots *snapshots = island->snapshots;
+  NeighborSnapshot *snapshot = (NeighborSnapshot *) malloc(sizeof(NeighborSnapshot) + index->length * sizeof(Neighbor *));
+  snapshot->length = index->length;
+  snapshot->retire_epoch = 0;
+  snapshot->next_retired = NULL;
+  memcpy(snapshot->neighbors, index->neighbors, index->length * sizeof(Neighbor *));
+  NeighborSnapshot *old_snapshot = __atomic_exchange_n(&snapshots->current, snapshot, __ATOMIC_SEQ_CST);
+  const unsigned long long retire_epoch = __atomic_add_fetch(&snapshots->epoch, 1, __ATOMIC_SEQ_CST);
+  if (old_snapshot != NULL) {
+    old_snapshot->retire_epoch = retire_epoch;
+    old_snapshot->next_retired = snapshots->retired_snapshots;
+    snapshots->retired_snapshots = old_snapshot;
   }
-  */
-  // TODO does sockfd need to be closed?...
-  if (close(sockfd) == -1) {
-#ifdef NETISLANDS_DEBUG
-    perror("connect_send_close: close sockfd");
-#endif
-    //return EXIT_FAILURE;
-    return EXIT_SUCCESS; // ignore error
+  return retire_epoch;
+}
+
+// enter the current epoch and return the published snapshot, which stays valid (with all its
+// neighbors) until island_leave_snapshot. lock-free unless all reader slots are taken...
+static NeighborSnapshot *island_enter_snapshot(const Netislands_Island *island, int *slot) {
+  Snapshots *snapshots = island->snapshots;
+  for (;;) {
+    for (int i = 0; i < NETISLANDS_SNAPSHOT_READERS; i++) {
+      unsigned long long free_slot = 0;
+      const unsigned long long epoch = __atomic_load_n(&snapshots->epoch, __ATOMIC_SEQ_CST);
+      if (__atomic_compare_exchange_n(&snapshots->reader_epochs[i], &free_slot, epoch, 0,
+                                      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        *slot = i;
+        // loaded after announcing our epoch, so the snapshot cannot be retired before it...
+        return __atomic_load_n(&snapshots->current, __ATOMIC_SEQ_CST);
+      }
+    }
+    thrd_yield();
   }
-  return EXIT_SUCCESS;
 }
 
-static void send_join_to_neighbor(void *element, void *args) {
-  Neighbor *neighbor = (Neighbor *) element;
-  const char *message = (char *) args;
-  const long message_length = strlen(message) + 1; // include the terminating \0
-  const int ret = connect_send_close(neighbor->hostname, neighbor->port, NETISLANDS_JOIN_TAG, message, message_length);
-  if (ret == EXIT_FAILURE) {
-    neighbor->failure_count++;
-#ifdef NETISLANDS_DEBUG
-    fprintf(stderr, "send_join_to_neighbor: Failed to send to neighbor %s:%d. (failure count = %u)\n",
-            neighbor->hostname, neighbor->port, neighbor->failure_count);
-#endif
+static void island_leave_snapshot(const Netislands_Island *island, const int slot) {
+  __atomic_store_n(&island->snapshots->reader_epochs[slot], 0, __ATOMIC_SEQ_CST);
+}
+
+static long snapshot_position(const NeighborSnapshot *snapshot, const unsigned id) {
+  long low = 0, high = snapshot->length - 1;
+  while (low <= high) {
+    const long middle = low + (high - low) / 2;
+    if (snapshot->neighbors[middle]->id == id) {
+      return middle;
+    } else if (snapshot->neighbors[middle]->id < id) {
+      low = middle + 1;
+    } else {
+      high = middle - 1;
+    }
   }
+  return -1;
 }
 
-static void remove_failed_neighbors(Queue *neighbor_queue, const unsigned max_failures) {
-  if (max_failures == 0) { // do nothing when neighbor removal is disabled
-    return;
+static void add_neighbor(const Netislands_Island *island, Neighbor *neighbor) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  Netislands_Neighbor_Index *index = island->neighbor_index;
+  if (index->length == index->capacity) {
+    index->capacity = index->capacity ? 2 * index->capacity : 16;
+    index->neighbors = (Neighbor **) realloc(index->neighbors, index->capacity * sizeof(Neighbor *));
   }
+  neighbor->id = index->next_id++; // ids increase, so appending keeps the index ordered
+  index->neighbors[index->length++] = neighbor;
+  queue_enqueue(island->neighbor_queue, neighbor);
+  neighbor->outbound_frames = (OutboundFrame **) malloc(island->outbound->capacity * sizeof(OutboundFrame *));
+  island_publish_snapshot(island);
+  free_retired_snapshots(island);
+}
+
+// find the neighbor with the given client address and (server) port, NULL if unknown...
+static Neighbor *find_neighbor(const Netislands_Island *island, const struct sockaddr_storage *client_address,
+                               const int port) {
   // this assumes that we have a mutex lock on neighbor_queue!
-  long failed_neighbor_index;
-  for (;;) { 
-    // search for a failed neighbor...
-    failed_neighbor_index = -1;
-    long current_index = 0;
-    for (QueueNode *iterator = neighbor_queue->front; iterator != NULL; iterator = iterator->next) {
-      const Neighbor *current_neighbor = (const Neighbor *) iterator->data; 
-      if (current_neighbor->failure_count >= max_failures) {
-        failed_neighbor_index = current_index;
+  Neighbor sender;
+  sender.port = port;
+  init_neighbor_address_from_client(&sender, client_address);
+  const long sender_index = queue_first_index_of(island->neighbor_queue, &sender, &neighbor_equal_predicate);
+  Neighbor *known_neighbor = NULL;
+  if (sender_index != -1) {
+    queue_get_index(island->neighbor_queue, sender_index, (void **) &known_neighbor);
+  }
+  return known_neighbor;
+}
+
+// queue a frame that is not a data message for neighbors, sent in the background by the sender
+// threads, so that the reactor thread never waits for a neighbor...
+static void island_queue_control_frame(const Netislands_Island *island, Neighbor *const *neighbors,
+                                       const long n_neighbors, const Frame *frame) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  OutboundFrame *outbound_frame = new_outbound_frame(frame, OUTBOUND_CONTROL);
+  for (long i = 0; i < n_neighbors; i++) {
+    neighbor_enqueue_frame(island, neighbors[i], outbound_frame, 0);
+  }
+  release_outbound_frame(outbound_frame);
+}
+
+// advertise our fill level to neighbors, advertisements are best effort...
+static void island_queue_fill_level(const Netislands_Island *island, Neighbor *const *neighbors, const long n_neighbors) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  char fill_string[NETISLANDS_MAX_FILL_STRING_LENGTH];
+  sprintf(fill_string, "%d %d", island->port, island->advertised_fill_level);
+  const Frame frame = {NETISLANDS_FILL_TAG, fill_string, strlen(fill_string) + 1, NULL, 0, island};
+  island_queue_control_frame(island, neighbors, n_neighbors, &frame);
+}
+
+static long message_queue_length(const Netislands_Island *island) {
+  // this assumes that we have a mutex lock on message_queue!
+  if (island->message_queue_mode == NETISLANDS_QUEUE_PRIORITY) {
+    return priority_queue_length(island->message_priority_queue);
+  } else {
+    return queue_length(island->message_queue);
+  }
+}
+
+static int journal_queued_message(Journal *journal, QueuedMessage *queued_message) {
+  const Netislands_Message *message = &queued_message->message;
+  queued_message->journal_offset = journal_append(journal, JOURNAL_RECORD_LIVE, message->type, queued_message->priority,
+                                                  (const char *) message->values,
+                                                  message->length * value_size(message->type));
+  return queued_message->journal_offset != -1;
+}
+
+// append records of all queued messages to the journal, returns 0 if some did not fit...
+static int journal_queued_messages(const Netislands_Island *island, Journal *journal) {
+  // this assumes that we have a mutex lock on message_queue!
+  int complete = 1;
+  if (island->message_queue_mode == NETISLANDS_QUEUE_PRIORITY) {
+    const PriorityQueue *queue = island->message_priority_queue;
+    for (long i = 0; i < queue->length; i++) {
+      complete &= journal_queued_message(journal, (QueuedMessage *) queue->nodes[i].data);
+    }
+  } else {
+    for (QueueNode *iterator = island->message_queue->front; iterator != NULL; iterator = iterator->next) {
+      complete &= journal_queued_message(journal, (QueuedMessage *) iterator->data);
+    }
+  }
+  return complete;
+}
+
+// rewrite the journal with records of the queued messages only, growing it if necessary. the new
+// journal is written to a temporary file that replaces the journal once it is complete, so that a
+// crash while compacting does not lose the queued messages...
+static void island_compact_journal(const Netislands_Island *island) {
+  // this assumes that we have a mutex lock on message_queue!
+  Journal *journal = island->journal;
+  Journal rewrite;
+  if (journal_open_rewrite(journal, &rewrite) == EXIT_SUCCESS) {
+    while (!journal_queued_messages(island, &rewrite)
+           && journal_grow(&rewrite, 2 * rewrite.capacity) == EXIT_SUCCESS) {
+      journal_reset(&rewrite);
+    } // messages that did not fit stay unjournaled
+    if (journal_replace(journal, &rewrite) == EXIT_SUCCESS) {
+      return;
+    }
+  }
+  // the temporary file could not be written, rewrite the journal in place...
+  for (;;) {
+    journal_reset(journal);
+    if (journal_queued_messages(island, journal) || journal_grow(journal, 2 * journal->capacity) == EXIT_FAILURE) {
+      break;
+    }
+  }
+}
+
+static void island_journal_message(const Netislands_Island *island, QueuedMessage *queued_message) {
+  // this assumes that we have a mutex lock on message_queue!
+  if (!journal_queued_message(island->journal, queued_message)) { // journal full, truncate it
+    island_compact_journal(island);
+  }
+}
+
+static void island_journal_sent_message(const Netislands_Island *island, const Netislands_Value_Type type,
+                                        const void *values, const long n_values, const double priority) {
+  // don't take the lock if sent messages are not journaled, the check is repeated under the lock...
+  if (__atomic_load_n(&island->journal, __ATOMIC_RELAXED) == NULL
+      || !(__atomic_load_n(&island->journal_flags, __ATOMIC_RELAXED) & NETISLANDS_JOURNAL_SENT)) {
+    return;
+  }
+  mtx_lock(island->message_queue_mutex);
+  if (island->journal != NULL && (island->journal_flags & NETISLANDS_JOURNAL_SENT)
+      && journal_append(island->journal, JOURNAL_RECORD_SENT, type, priority, (const char *) values,
+                        n_values * value_size(type)) == -1) {
+    island_compact_journal(island); // sent records are dropped by compaction
+  }
+  mtx_unlock(island->message_queue_mutex);
+}
+
+static void island_truncate_journal(const Netislands_Island *island) {
+  if (__atomic_load_n(&island->journal, __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+  mtx_lock(island->message_queue_mutex);
+  Journal *journal = island->journal;
+  if (journal != NULL) {
+    // reset the journal once all messages are consumed, compact it when it is mostly dead...
+    if (journal->n_live == 0 && journal->tail > JOURNAL_HEADER_LENGTH) {
+      journal_reset(journal);
+    } else if (journal->tail > journal->capacity / 2
+               && journal->live_bytes < (journal->tail - JOURNAL_HEADER_LENGTH) / 4) {
+      island_compact_journal(island);
+    }
+    journal_flush(journal);
+  }
+  mtx_unlock(island->message_queue_mutex);
+}
+
+static long queued_message_bytes(const QueuedMessage *queued_message) {
+  return queued_message->message.length * value_size(queued_message->message.type);
+}
+
+// returns 1 if the message queue has no room for a message of the given size within its limits...
+static int message_queue_full(const Netislands_Island *island, const long bytes) {
+  // this assumes that we have a mutex lock on message_queue!
+  return (island->max_message_queue_length != 0 && message_queue_length(island) >= island->max_message_queue_length)
+    || (island->max_message_queue_bytes != 0 && island->counters->message_queue_bytes + bytes > island->max_message_queue_bytes);
+}
+
+static void island_discard_message(const Netislands_Island *island, QueuedMessage *queued_message) {
+  // this assumes that we have a mutex lock on message_queue!
+  if (island->journal != NULL && queued_message->journal_offset != -1) {
+    journal_consume(island->journal, queued_message->journal_offset);
+  }
+  free(queued_message->message.buffer);
+  free(queued_message);
+}
+
+// insert a message into the message queue, or drop it if the queue is full and the message is not
+// worth keeping. Returns 1 if the message was inserted...
+static int island_insert_message(Netislands_Island *island, QueuedMessage *queued_message) {
+  // this assumes that we have a mutex lock on message_queue!
+  const long bytes = queued_message_bytes(queued_message);
+  if (island->max_message_queue_bytes != 0 && bytes > island->max_message_queue_bytes) { // would never fit
+    __atomic_fetch_add(&island->stats->messages_dropped, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  // while a limit is exceeded, drop the lowest priority message (in priority mode) or the oldest
+  // message. the new message itself is dropped if it has the lowest priority...
+  while (message_queue_full(island, bytes)) {
+    QueuedMessage *message_to_drop = NULL;
+    if (island->message_queue_mode == NETISLANDS_QUEUE_PRIORITY) {
+      double min_priority;
+      if (priority_queue_peek_min(island->message_priority_queue, &min_priority, NULL) != EXIT_FAILURE
+          && queued_message->priority > min_priority) { // older messages win ties
+        priority_queue_remove_min(island->message_priority_queue, NULL, (void **) &message_to_drop);
+      }
+    } else {
+      queue_dequeue(island->message_queue, (void **) &message_to_drop);
+    }
+    __atomic_fetch_add(&island->stats->messages_dropped, 1, __ATOMIC_RELAXED);
+    if (NULL == message_to_drop) {
+      return 0;
+    }
+    island->counters->message_queue_bytes -= queued_message_bytes(message_to_drop);
+    island_discard_message(island, message_to_drop);
+  }
+  if (island->message_queue_mode == NETISLANDS_QUEUE_PRIORITY) {
+    priority_queue_insert(island->message_priority_queue, queued_message->priority, queued_message);
+  } else {
+    queue_enqueue(island->message_queue, queued_message);
+  }
+  island->counters->message_queue_bytes += bytes;
+  __atomic_fetch_add(&island->stats->messages_received, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+// fast non-cryptographic hash of a message's values (8 bytes at a time, finished with splitmix64)...
+static uint64_t hash_values(const Netislands_Value_Type type, const char *values, const long length) {
+  uint64_t hash = (0x9E3779B97F4A7C15ULL * ((uint64_t) type + 1)) ^ (uint64_t) length;
+  long i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t chunk;
+    memcpy(&chunk, values + i, 8);
+    hash = (hash ^ chunk) * 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 29;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, values + i, length - i);
+  hash = (hash ^ tail) * 0x94D049BB133111EBULL;
+  hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBULL;
+  return hash ^ (hash >> 31);
+}
+
+// remember the contents of a received message in the dedup table, returns 1 if it was received
+// recently. like the seen set, the table is direct-mapped and forgets old contents...
+static int island_duplicate_message(const Netislands_Island *island, const Netislands_Value_Type type,
+                                    const char *values, const long n_values) {
+  uint64_t hash = hash_values(type, values, n_values * value_size(type));
+  hash = hash != 0 ? hash : 1; // 0 marks empty slots
+  unsigned long long *slot = &island->dedup_hashes[hash % (uint64_t) island->dedup_length];
+  return __atomic_exchange_n(slot, (unsigned long long) hash, __ATOMIC_RELAXED) == hash;
+}
+
+// store received values in the message queue, either as a copy or, if buffer is not NULL, by taking
+// over the buffer holding the values. Returns 1 if the buffer was taken over...
+static int island_enqueue_message(Netislands_Island *island, const Netislands_Value_Type type, char *values,
+                                  const long n_values, char *buffer, const double priority, const long sender_id) {
+  if (island->dedup_length > 0 && island_duplicate_message(island, type, values, n_values)) {
+    __atomic_fetch_add(&island->stats->messages_deduplicated, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  mtx_lock(island->message_queue_mutex);
+  // in priority mode, check whether the message would be dropped right away before copying it...
+  if (island->message_queue_mode == NETISLANDS_QUEUE_PRIORITY
+      && message_queue_full(island, n_values * value_size(type))
+      && priority_queue_length(island->message_priority_queue) > 0) {
+    double min_priority;
+    priority_queue_peek_min(island->message_priority_queue, &min_priority, NULL);
+    if (priority <= min_priority) { // older messages win ties
+      __atomic_fetch_add(&island->stats->messages_dropped, 1, __ATOMIC_RELAXED);
+      mtx_unlock(island->message_queue_mutex);
+      return 0;
+    }
+  }
+  QueuedMessage *new_message = (QueuedMessage *) malloc(sizeof(QueuedMessage));
+  new_message->message.type = type;
+  new_message->message.length = n_values;
+  new_message->priority = priority;
+  new_message->journal_offset = -1;
+  new_message->sender_id = sender_id;
+  new_message->enqueue_usecs = sender_id != -1 ? monotonic_usecs() : 0;
+  if (buffer != NULL) {
+    // shrink the buffer to the message, common allocators do this in place...
+    const long values_offset = values - buffer;
+    char *shrunk_buffer = (char *) realloc(buffer, values_offset + n_values * value_size(type));
+    if (shrunk_buffer != NULL) {
+      buffer = shrunk_buffer;
+    }
+    new_message->message.buffer = buffer;
+    new_message->message.values = buffer + values_offset;
+  } else {
+    new_message->message.buffer = malloc(n_values > 0 ? n_values * value_size(type) : 1);
+    memcpy(new_message->message.buffer, values, n_values * value_size(type));
+    new_message->message.values = new_message->message.buffer;
+  }
+  if (!island_insert_message(island, new_message)) { // too large for the byte budget
+    island_discard_message(island, new_message); // frees a taken over buffer, too
+  } else if (island->journal != NULL) {
+    island_journal_message(island, new_message);
+  }
+  mtx_unlock(island->message_queue_mutex);
+  return buffer != NULL;
+}
+
+static void island_advertise_fill_level(Netislands_Island *island) {
+  if (island->max_message_queue_length == 0 && island->max_message_queue_bytes == 0) { // unbounded message queues never drop messages
+    return;
+  }
+  mtx_lock(island->message_queue_mutex);
+  // bounded priority queues keep the best messages, so new messages are not necessarily dropped.
+  // with both limits, the fuller one counts...
+  int fill_level = 0;
+  if (island->message_queue_mode != NETISLANDS_QUEUE_PRIORITY) {
+    if (island->max_message_queue_length != 0) {
+      fill_level = (int) (1000 * message_queue_length(island) / island->max_message_queue_length);
+    }
+    if (island->max_message_queue_bytes != 0) {
+      const int bytes_fill_level = (int) (1000.0 * island->counters->message_queue_bytes / island->max_message_queue_bytes);
+      fill_level = bytes_fill_level > fill_level ? bytes_fill_level : fill_level;
+    }
+  }
+  mtx_unlock(island->message_queue_mutex);
+  // advertise crossings of the low watermark, significant changes while loaded, and repeat
+  // advertisements while loaded so that senders keep throttling...
+  const long long now = monotonic_msecs();
+  const int loaded = fill_level > NETISLANDS_BACKPRESSURE_LOW_WATERMARK;
+  const int was_loaded = island->advertised_fill_level > NETISLANDS_BACKPRESSURE_LOW_WATERMARK;
+  if (loaded == was_loaded
+      && !(loaded && (abs(fill_level - island->advertised_fill_level) >= NETISLANDS_BACKPRESSURE_STEP
+                      || now - island->advertised_fill_level_time >= NETISLANDS_BACKPRESSURE_HEARTBEAT_MSECS))) {
+    return;
+  }
+  island->advertised_fill_level = fill_level;
+  island->advertised_fill_level_time = now;
+  mtx_lock(island->neighbor_queue_mutex);
+  island_queue_fill_level(island, island->neighbor_index->neighbors, island->neighbor_index->length);
+  mtx_unlock(island->neighbor_queue_mutex);
+}
+
+// apply the socket options of an island to a sending socket...
+static void set_client_socket_options(const int sockfd, const Netislands_Socket_Options *options) {
+  if (options->send_buffer_length > 0) {
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &options->send_buffer_length, sizeof options->send_buffer_length);
+  }
+  if (options->tcp_nodelay) {
+    const int option_value = 1;
+    setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &option_value, sizeof option_value);
+  }
+}
+
+static int open_server_socket(const Netislands_Config *config) {
+  const int port = config->port;
+  int listenfd;
+
+  // prefer a dual-stack IPv6 server socket that accepts IPv4 connections too, fall back to IPv4...
+  struct sockaddr_storage server_address;
+  socklen_t server_address_length;
+  memset((char *) &server_address, 0, sizeof(server_address));
+  if ((listenfd = socket(AF_INET6, SOCK_STREAM, IPPROTO_TCP)) != -1) {
+    int v6only = 0;
+    setsockopt(listenfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof v6only);
+    struct sockaddr_in6 *server_address6 = (struct sockaddr_in6 *) &server_address;
+    server_address6->sin6_family = AF_INET6;
+    server_address6->sin6_addr = in6addr_any;
+    server_address6->sin6_port = htons(port);
+    server_address_length = sizeof(struct sockaddr_in6);
+  } else if ((listenfd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) != -1) {
+    struct sockaddr_in *server_address4 = (struct sockaddr_in *) &server_address;
+    server_address4->sin_family = AF_INET;
+    server_address4->sin_addr.s_addr = htonl(INADDR_ANY);
+    server_address4->sin_port = htons(port);
+    server_address_length = sizeof(struct sockaddr_in);
+  } else {
+#ifdef NETISLANDS_DEBUG
+    perror("socket");
+#endif
+    return -1;
+  }
+  // allow socket address reuse to avoid "address alreay in use" errors...
+  int option_value = 1;
+  setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &option_value, sizeof option_value);
+  // accepted connections inherit the receive buffer size, which has to be set before listening...
+  if (config->socket_options.receive_buffer_length > 0) {
+    setsockopt(listenfd, SOL_SOCKET, SO_RCVBUF, &config->socket_options.receive_buffer_length,
+               sizeof config->socket_options.receive_buffer_length);
+  }
+
+  if (bind(listenfd, (struct sockaddr *)&server_address, server_address_length) == -1) {
+#ifdef NETISLANDS_DEBUG
+    perror("bind");
+#endif
+    close(listenfd);
+    return -1;
+  }
+  if (listen(listenfd, config->backlog) == -1) {
+#ifdef NETISLANDS_DEBUG
+    perror("listen");
+#endif
+    close(listenfd);
+    return -1;
+  }
+#ifdef NETISLANDS_DEBUG
+  fprintf(stderr, "Server socket bound to port %d. Listening for a TCP connection...\n",
+          port);
+#endif
+  return listenfd;
+}
+
+static void capture_frame(const int port, const char *message, const long message_length) {
+  char record_header[NETISLANDS_CAPTURE_RECORD_HEADER_LENGTH];
+  mtx_lock(&capture_mutex);
+  if (capture_file != NULL) {
+    encode_uint64((uint64_t) (monotonic_usecs() - capture_start_usecs), record_header);
+    encode_uint32((uint32_t) port, record_header + 8);
+    encode_uint32((uint32_t) message_length, record_header + 12);
+    fwrite(record_header, 1, NETISLANDS_CAPTURE_RECORD_HEADER_LENGTH, capture_file);
+    fwrite(message, 1, message_length, capture_file);
+  }
+  mtx_unlock(&capture_mutex);
+}
+
+int netislands_start_capture(const char *path) {
+  call_once(&netislands_mutex_once, &netislands_mutex_init);
+  mtx_lock(&capture_mutex);
+  if (capture_file != NULL) { // already capturing
+    mtx_unlock(&capture_mutex);
+    return EXIT_FAILURE;
+  }
+  if ((capture_file = fopen(path, "wb")) == NULL) {
+    fprintf(stderr, "netislands_start_capture: error opening capture file '%s'.\n", path);
+    mtx_unlock(&capture_mutex);
+    return EXIT_FAILURE;
+  }
+  setvbuf(capture_file, NULL, _IOFBF, NETISLANDS_CAPTURE_BUFFER_LENGTH);
+  fwrite(NETISLANDS_CAPTURE_MAGIC, 1, strlen(NETISLANDS_CAPTURE_MAGIC), capture_file);
+  capture_start_usecs = monotonic_usecs();
+  __atomic_store_n(&capturing, 1, __ATOMIC_RELAXED);
+  mtx_unlock(&capture_mutex);
+  return EXIT_SUCCESS;
+}
+
+int netislands_stop_capture(void) {
+  call_once(&netislands_mutex_once, &netislands_mutex_init);
+  mtx_lock(&capture_mutex);
+  if (NULL == capture_file) {
+    mtx_unlock(&capture_mutex);
+    return EXIT_FAILURE;
+  }
+  __atomic_store_n(&capturing, 0, __ATOMIC_RELAXED);
+  const int ret = fclose(capture_file) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  capture_file = NULL;
+  mtx_unlock(&capture_mutex);
+  return ret;
+}
+
+int netislands_set_link_emulation(const unsigned n_links, const LinkEmulation links[n_links],
+                                  const unsigned long seed) {
+  return emulation_set_links(n_links, links, seed);
+}
+
+int netislands_load_link_emulation(const char *path, const unsigned long seed) {
+  return emulation_load_links(path, seed);
+}
+
+static int island_send_frame(const Netislands_Island *island, const Frame *frame, const int background);
+
+static uint64_t island_random_next(const Netislands_Island *island) {
+  // splitmix64, safe without a lock as every caller advances the state by its own increment...
+  uint64_t z = __atomic_add_fetch(&island->neighbor_index->random_state, 0x9E3779B97F4A7C15ULL, __ATOMIC_RELAXED);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+// remember a forwarded message in the seen set, returns 1 if it was seen before. the seen set is
+// direct-mapped, so an old message is forgotten when a newer one hashes to its slot...
+static int island_seen_message(const Netislands_Island *island, const unsigned long long origin_id,
+                               const unsigned long sequence) {
+  // this assumes that we have a mutex lock on neighbor_queue!
+  uint64_t key = origin_id ^ ((uint64_t) sequence * 0x9E3779B97F4A7C15ULL);
+  key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  key = (key ^ (key >> 27)) * 0x94D049BB133111EBULL;
+  key ^= key >> 31;
+  key = key != 0 ? key : 1; // 0 marks empty slots
+  unsigned long long *slot = &island->seen_ids[key % NETISLANDS_SEEN_SET_LENGTH];
+  if (*slot == key) {
+    return 1;
+  }
+  *slot = key;
+  return 0;
+}
+
+// pass a forwarded message on to all neighbors while it has hops left, returns EXIT_FAILURE if
+// the message is a duplicate (or our own message coming back). relays are queued for the sender
+// threads, so that the reactor thread does not wait for the neighbors...
+static int island_relay_message(Netislands_Island *island, const DataHeader *header, const char *data,
+                                const long data_length) {
+  mtx_lock(island->neighbor_queue_mutex);
+  const int seen = header->origin_id == island->origin_id
+    || island_seen_message(island, header->origin_id, header->forward_sequence);
+  mtx_unlock(island->neighbor_queue_mutex);
+  if (seen) {
+    __atomic_fetch_add(&island->stats->duplicates_dropped, 1, __ATOMIC_RELAXED);
+    return EXIT_FAILURE;
+  }
+  if (header->ttl > 1) {
+    // the send time of relayed messages would be accounted to the wrong neighbor, drop it...
+    DataHeader relay_header = *header;
+    relay_header.flags &= ~NETISLANDS_XDATA_TIMING;
+    relay_header.ttl--;
+    char payload[NETISLANDS_MAX_XDATA_HEADER_LENGTH];
+    const Frame frame = {NETISLANDS_XDATA_TAG, payload, encode_data_header(&relay_header, payload), data, data_length, island};
+    island_send_frame(island, &frame, 1);
+    __atomic_fetch_add(&island->stats->messages_relayed, 1, __ATOMIC_RELAXED);
+  }
+  return EXIT_SUCCESS;
+}
+
+static void free_stream(Netislands_Stream *stream) {
+  while (stream->chunks != NULL) {
+    StreamChunk *next = stream->chunks->next;
+    free(stream->chunks->data);
+    free(stream->chunks);
+    stream->chunks = next;
+  }
+  free(stream);
+}
+
+static void unlink_stream(Streams *streams, Netislands_Stream *stream) {
+  // this assumes that we have a mutex lock on streams!
+  Netislands_Stream **link = &streams->incoming;
+  while (*link != stream) {
+    link = &(*link)->next;
+  }
+  *link = stream->next;
+}
+
+static Netislands_Stream *new_incoming_stream(const Netislands_Island *island) {
+  Netislands_Stream *stream = (Netislands_Stream *) calloc(1, sizeof(Netislands_Stream));
+  stream->island = island;
+  stream->sockfd = -1;
+  stream->connected = 1;
+  mtx_lock(&island->streams->mutex);
+  Netislands_Stream **link = &island->streams->incoming;
+  while (*link != NULL) {
+    link = &(*link)->next;
+  }
+  *link = stream;
+  mtx_unlock(&island->streams->mutex);
+  return stream;
+}
+
+// strip the record headers from received stream data, moving the record data to the front of the
+// buffer. returns the length of the record data...
+static long stream_unpack_records(Netislands_Stream *stream, char *data, const long length) {
+  // this assumes that we have a mutex lock on streams!
+  long position = 0, data_length = 0;
+  while (position < length && !stream->end_received) {
+    if (stream->record_remaining == 0) { // in a record header
+      stream->record_header[stream->record_header_length++] = data[position++];
+      if (stream->record_header_length == NETISLANDS_STREAM_RECORD_HEADER_LENGTH) {
+        stream->record_header_length = 0;
+        stream->record_remaining = decode_uint32(stream->record_header);
+        stream->end_received = stream->record_remaining == 0;
+      }
+    } else {
+      const long n = (long) stream->record_remaining < length - position ? (long) stream->record_remaining : length - position;
+      memmove(data + data_length, data + position, n);
+      data_length += n;
+      position += n;
+      stream->record_remaining -= n;
+    }
+  }
+  return data_length; // anything after the end record is ignored
+}
+
+// take received data of an incoming stream, returns 1 if the buffer was taken over and -1 if the
+// stream was closed by its reader...
+static int stream_receive(Netislands_Stream *stream, char *buffer, const long offset, const long length,
+                          const int status) {
+  Streams *streams = stream->island->streams;
+  int ret = 0;
+  mtx_lock(&streams->mutex);
+  if (stream->closed) { // nobody reads anymore, drop the connection
+    unlink_stream(streams, stream);
+    mtx_unlock(&streams->mutex);
+    free_stream(stream);
+    return -1;
+  }
+  if (status != REACTOR_STREAM_ABORT) {
+    const long data_length = stream_unpack_records(stream, buffer + offset, length - offset);
+    if (data_length > 0) {
+      StreamChunk *chunk = (StreamChunk *) malloc(sizeof(StreamChunk));
+      memmove(buffer, buffer + offset, data_length);
+      // shrink the buffer to the data, common allocators do this in place...
+      char *shrunk_buffer = (char *) realloc(buffer, data_length);
+      chunk->data = shrunk_buffer != NULL ? shrunk_buffer : buffer;
+      chunk->length = data_length;
+      chunk->next = NULL;
+      if (NULL == stream->chunks) {
+        stream->chunks = chunk;
+      } else {
+        stream->last_chunk->next = chunk;
+      }
+      stream->last_chunk = chunk;
+      stream->buffered_bytes += data_length;
+      ret = 1;
+    }
+  }
+  if (status == REACTOR_STREAM_MORE && stream->buffered_bytes >= NETISLANDS_STREAM_WINDOW) {
+    stream->paused = 1; // the reader falls behind, stop reading the connection
+    ret |= REACTOR_STREAM_PAUSE;
+  }
+  if (status != REACTOR_STREAM_MORE) { // a stream without end record is incomplete
+    stream->connected = 0;
+  }
+  cnd_broadcast(&streams->data_available);
+  mtx_unlock(&streams->mutex);
+  return ret;
+}
+
+static int island_handle_stream(void *context, void **stream, char *data, const long length, const int status,
+                                const struct sockaddr_storage *client_address) {
+  const Netislands_Island *island = (Netislands_Island *) context;
+  (void) client_address;
+  long offset = 0;
+  if (NULL == *stream) { // first data of the connection, only streams are taken
+    if (check_netislands_message(data, length) == EXIT_FAILURE
+        || strncmp(data + NETISLANDS_PROTOCOL_ID_LENGTH + NETISLANDS_PROTOCOL_VERSION_LENGTH,
+                   NETISLANDS_STREAM_TAG, NETISLANDS_TAG_LENGTH) != 0) {
+      return 0;
+    }
+    *stream = new_incoming_stream(island);
+    offset = NETISLANDS_PROTOCOL_HEADER_LENGTH;
+  }
+  return stream_receive((Netislands_Stream *) *stream, data, offset, length, status);
+}
+
+static long message_bytes(const Netislands_Message *message) {
+  return message->length * value_size(message->type);
+}
+
+// answer a pull request of a neighbor with up to k messages, taken from the outbox and then from
+// the provider. the replies are queued for the sender threads, no more than the requester's
+// outbound queue has room for. each message is sent as a typed data message, which the requester
+// does not forward...
+static void island_serve_pull(const Netislands_Island *island, const struct sockaddr_storage *client_address,
+                              const int port, const uint32_t k) {
+  mtx_lock(island->neighbor_queue_mutex);
+  const Neighbor *requester = find_neighbor(island, client_address, port);
+  const long room = requester != NULL ? island->outbound->capacity - requester->outbound_length : 0;
+  const unsigned requester_id = requester != NULL ? requester->id : 0;
+  mtx_unlock(island->neighbor_queue_mutex);
+  long n_requested = k < NETISLANDS_MAX_PULL_MESSAGES ? (long) k : NETISLANDS_MAX_PULL_MESSAGES;
+  n_requested = room < n_requested ? room : n_requested;
+  if (n_requested <= 0) { // unknown requester or no room for replies
+    return;
+  }
+  Pull *pull = island->pull;
+  Netislands_Message *messages = (Netislands_Message *) malloc(n_requested * sizeof(Netislands_Message));
+  long n_messages = 0;
+  mtx_lock(&pull->mutex);
+  Netislands_Message *outbox_message;
+  while (n_messages < n_requested && queue_dequeue(&pull->outbox, (void **) &outbox_message) != EXIT_FAILURE) {
+    pull->outbox_bytes -= message_bytes(outbox_message);
+    messages[n_messages++] = *outbox_message;
+    free(outbox_message);
+  }
+  const Netislands_Provider provider = pull->provider;
+  void *provider_context = pull->provider_context;
+  mtx_unlock(&pull->mutex);
+  if (n_messages < n_requested && provider != NULL) { // the provider is called without holding a lock
+    const long n_provided = provider(provider_context, messages + n_messages, n_requested - n_messages);
+    if (n_provided > 0) {
+      n_messages += n_provided < n_requested - n_messages ? n_provided : n_requested - n_messages;
+    }
+  }
+  // copy the replies into outbound frames before taking the neighbor_queue lock to queue them...
+  OutboundFrame **replies = (OutboundFrame **) malloc(n_requested * sizeof(OutboundFrame *));
+  long n_replies = 0;
+  for (long i = 0; i < n_messages; i++) {
+    if (value_size(messages[i].type) != 0) {
+      DataHeader header;
+      init_data_header(&header, NETISLANDS_XDATA_VALUES);
+      header.value_type = messages[i].type;
+      char payload[NETISLANDS_MAX_XDATA_HEADER_LENGTH];
+      const Frame frame = {NETISLANDS_XDATA_TAG, payload, encode_data_header(&header, payload),
+                           (const char *) messages[i].values, message_bytes(&messages[i]), island};
+      replies[n_replies++] = new_outbound_frame(&frame, OUTBOUND_SERVED);
+    }
+    island_free_message(&messages[i]);
+  }
+  free(messages);
+  mtx_lock(island->neighbor_queue_mutex);
+  const long position = neighbor_index_position(island->neighbor_index, requester_id);
+  for (long i = 0; i < n_replies; i++) {
+    if (position != -1) { // the requester may have been removed meanwhile
+      neighbor_enqueue_frame(island, island->neighbor_index->neighbors[position], replies[i], 0);
+    }
+    release_outbound_frame(replies[i]);
+  }
+  mtx_unlock(island->neighbor_queue_mutex);
+  free(replies);
+}
+
+static int island_handle_message(void *context, char *message, const long message_length,
+                                 const struct sockaddr_storage *client_address) {
+  Netislands_Island *island = (Netislands_Island *) context;
+  if (__atomic_load_n(&capturing, __ATOMIC_RELAXED)) { // record the frame as it was received
+    capture_frame(island->port, message, message_length);
+  }
+  if (check_netislands_message(message, message_length) == EXIT_FAILURE) {
+#ifdef NETISLANDS_DEBUG
+    fprintf(stderr, "Received malformed netislands message, ignoring. (%s line# %d)\n", __FILE__, __LINE__);
+#endif
+    return 0;
+  }
+  char tag[NETISLANDS_TAG_LENGTH];
+  strncpy(tag, message + NETISLANDS_PROTOCOL_ID_LENGTH + NETISLANDS_PROTOCOL_VERSION_LENGTH, NETISLANDS_TAG_LENGTH); 
+
+  // handle message based on message tag...
+  if (strcmp(NETISLANDS_DATA_TAG, tag) == 0) { // data message
+    // store the received data message content in the islands message_queue...
+    island_enqueue_message(island, NETISLANDS_VALUES_BYTES, message + NETISLANDS_PROTOCOL_HEADER_LENGTH,
+                           message_length - NETISLANDS_PROTOCOL_HEADER_LENGTH, NULL, 0.0, -1);
+  } else if (strcmp(NETISLANDS_XDATA_TAG, tag) == 0) { // data message with extended header
+    DataHeader header;
+    char *payload = message + NETISLANDS_PROTOCOL_HEADER_LENGTH;
+    const long payload_length = message_length - NETISLANDS_PROTOCOL_HEADER_LENGTH;
+    const long header_length = decode_data_header(payload, payload_length, &header);
+    const long size = header_length != -1 ? value_size(header.value_type) : 1;
+    if (header_length == -1 || (payload_length - header_length) % size != 0) {
+#ifdef NETISLANDS_DEBUG
+      fprintf(stderr, "Received malformed extended data header, ignoring. (%s line# %d)\n", __FILE__, __LINE__);
+#endif
+      return 0;
+    }
+    char *values = payload + header_length;
+    const long n_values = (payload_length - header_length) / size;
+    if (header.big_endian != host_is_big_endian()) { // convert values to host byte order in place
+      swap_value_bytes(values, n_values, size);
+      header.big_endian = host_is_big_endian();
+    }
+    // pass forwarded messages on before queueing them, as the queue may take over the buffer...
+    if ((header.flags & NETISLANDS_XDATA_FORWARD)
+        && island_relay_message(island, &header, values, payload_length - header_length) == EXIT_FAILURE) {
+      return 0; // seen before
+    }
+    // account the network time of timed messages to their sending neighbor...
+    long sender_id = -1;
+    if (header.flags & NETISLANDS_XDATA_TIMING) {
+      const long long network_usecs = realtime_usecs() - header.timestamp;
+      mtx_lock(island->neighbor_queue_mutex);
+      Neighbor *sender = find_neighbor(island, client_address, header.origin_port);
+      if (sender != NULL) {
+        latency_histogram_add(&sender->latency.network, network_usecs);
+        sender_id = sender->id;
+      }
+      mtx_unlock(island->neighbor_queue_mutex);
+    }
+    // typed values are handed over in the receive buffer unless they are misaligned...
+    const int aligned = (uintptr_t) values % size == 0;
+    return island_enqueue_message(island, header.value_type, values, n_values,
+                                  header.value_type != NETISLANDS_VALUES_BYTES && aligned ? message : NULL,
+                                  header.priority, sender_id);
+  } else if (strcmp(NETISLANDS_JOIN_TAG, tag) == 0) { // join message
+    // create and initialize new neighbor...
+    Neighbor *new_neighbor = (Neighbor *) malloc(sizeof(Neighbor));
+    char port_string[NETISLANDS_MAX_PORT_STRING_LENGTH];
+    strncpy(port_string, message + NETISLANDS_PROTOCOL_HEADER_LENGTH, 8);
+    init_neighbor(new_neighbor, atoi(port_string));
+    init_neighbor_address_from_client(new_neighbor, client_address);
+    // check if the new neighbor is already in the neighbor queue...
+    mtx_lock(island->neighbor_queue_mutex);
+    long new_neighbor_index = queue_first_index_of(island->neighbor_queue, new_neighbor, &neighbor_equal_predicate); 
+    if (new_neighbor_index == -1) { // unknown new neighbor, add it to the queue...
+      add_neighbor(island, new_neighbor);
+    } else { // known new neighbor, reset its failure count...
+      free(new_neighbor);
+      queue_get_index(island->neighbor_queue, new_neighbor_index, (void **) &new_neighbor);
+      __atomic_store_n(&new_neighbor->failure_count, 0, __ATOMIC_RELAXED);
+    }
+    // reply with our fill level if the new neighbor should already throttle its sends...
+    if (island->advertised_fill_level > NETISLANDS_BACKPRESSURE_LOW_WATERMARK) {
+      island_queue_fill_level(island, &new_neighbor, 1);
+    }
+    mtx_unlock(island->neighbor_queue_mutex);
+  } else if (strcmp(NETISLANDS_FILL_TAG, tag) == 0) { // fill level advertisement
+    char fill_string[NETISLANDS_MAX_FILL_STRING_LENGTH];
+    const long fill_string_length = message_length - NETISLANDS_PROTOCOL_HEADER_LENGTH;
+    if (fill_string_length <= 0 || fill_string_length > NETISLANDS_MAX_FILL_STRING_LENGTH
+        || message[message_length - 1] != '\0') {
+#ifdef NETISLANDS_DEBUG
+      fprintf(stderr, "Received malformed fill level message, ignoring. (%s line# %d)\n", __FILE__, __LINE__);
+#endif
+      return 0;
+    }
+    memcpy(fill_string, message + NETISLANDS_PROTOCOL_HEADER_LENGTH, fill_string_length);
+    int port, fill_level;
+    if (sscanf(fill_string, "%d %d", &port, &fill_level) != 2) {
+      return 0;
+    }
+    // update the fill level of the sending neighbor, unknown neighbors are ignored...
+    mtx_lock(island->neighbor_queue_mutex);
+    Neighbor *known_neighbor = find_neighbor(island, client_address, port);
+    if (known_neighbor != NULL) {
+      __atomic_store_n(&known_neighbor->remote_fill_level, fill_level, __ATOMIC_RELAXED);
+      __atomic_store_n(&known_neighbor->remote_fill_level_expiry,
+                       monotonic_msecs() + 3 * NETISLANDS_BACKPRESSURE_HEARTBEAT_MSECS, __ATOMIC_RELAXED);
+    }
+    mtx_unlock(island->neighbor_queue_mutex);
+  } else if (strcmp(NETISLANDS_PING_TAG, tag) == 0) { // ping, echo the timestamp back to the sender
+    if (message_length - NETISLANDS_PROTOCOL_HEADER_LENGTH != NETISLANDS_PING_LENGTH) {
+      return 0;
+    }
+    char pong[NETISLANDS_PING_LENGTH];
+    encode_uint32((uint32_t) island->port, pong);
+    memcpy(pong + 4, message + NETISLANDS_PROTOCOL_HEADER_LENGTH + 4, 8);
+    const Frame frame = {NETISLANDS_PONG_TAG, pong, NETISLANDS_PING_LENGTH, NULL, 0, island};
+    // only neighbors are answered, through their outbound queue...
+    mtx_lock(island->neighbor_queue_mutex);
+    Neighbor *sender = find_neighbor(island, client_address, (int) decode_uint32(message + NETISLANDS_PROTOCOL_HEADER_LENGTH));
+    if (sender != NULL) {
+      island_queue_control_frame(island, &sender, 1, &frame);
+    }
+    mtx_unlock(island->neighbor_queue_mutex);
+  } else if (strcmp(NETISLANDS_PONG_TAG, tag) == 0) { // answer to our ping
+    if (message_length - NETISLANDS_PROTOCOL_HEADER_LENGTH != NETISLANDS_PING_LENGTH) {
+      return 0;
+    }
+    const char *pong = message + NETISLANDS_PROTOCOL_HEADER_LENGTH;
+    const long long round_trip_usecs = monotonic_usecs() - (long long) decode_uint64(pong + 4);
+    mtx_lock(island->neighbor_queue_mutex);
+    Neighbor *sender = find_neighbor(island, client_address, (int) decode_uint32(pong));
+    if (sender != NULL) {
+      latency_histogram_add(&sender->latency.round_trip, round_trip_usecs);
+    }
+    mtx_unlock(island->neighbor_queue_mutex);
+  } else if (strcmp(NETISLANDS_PULL_TAG, tag) == 0) { // a neighbor asks for messages
+    if (message_length - NETISLANDS_PROTOCOL_HEADER_LENGTH != NETISLANDS_PULL_LENGTH) {
+      return 0;
+    }
+    const char *pull = message + NETISLANDS_PROTOCOL_HEADER_LENGTH;
+    island_serve_pull(island, client_address, (int) decode_uint32(pull), decode_uint32(pull + 4));
+  } else if (strcmp(NETISLANDS_STREAM_TAG, tag) == 0) { // stream short enough to arrive in one piece
+    Netislands_Stream *stream = new_incoming_stream(island);
+    return stream_receive(stream, message, NETISLANDS_PROTOCOL_HEADER_LENGTH, message_length, REACTOR_STREAM_END) == 1;
+  } else { // unknown message tag
+#ifdef NETISLANDS_DEBUG
+    fprintf(stderr, "Received netislands message with unknown tag '%s', ignoring. (%s line# %d)\n", tag, __FILE__, __LINE__);
+#endif
+  }
+  return 0;
+}
+
+static void island_tick(void *context) {
+  island_advertise_fill_level((Netislands_Island *) context);
+  island_truncate_journal((Netislands_Island *) context);
+}
+
+static void set_segment(Segment *segment, const char *base, const long length) {
+  SEGMENT_BASE(*segment) = (char *) base;
+  SEGMENT_LENGTH(*segment) = length;
+}
+
+static int set_nonblocking(const int sockfd) {
+#ifdef _WIN32
+  u_long mode = 1;
+  return ioctlsocket(sockfd, FIONBIO, &mode) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
+  const int flags = fcntl(sockfd, F_GETFL, 0);
+  return (flags != -1 && fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) != -1) ? EXIT_SUCCESS : EXIT_FAILURE;
+#endif
+}
+
+// wait until a socket can be written to (or has failed), for at most timeout_msecs. waits in short
+// slices, so that destroying the island breaks it off. returns EXIT_FAILURE on timeout...
+static int wait_writable(const int sockfd, const Netislands_Island *island, const int timeout_msecs) {
+  const long long deadline = monotonic_msecs() + timeout_msecs;
+  while (!__atomic_load_n(&island->counters->stopping, __ATOMIC_RELAXED)) {
+    const long long remaining_msecs = deadline - monotonic_msecs();
+    if (remaining_msecs <= 0) {
+      break;
+    }
+    struct pollfd pollfds[2];
+    pollfds[0].fd = sockfd;
+    pollfds[0].events = POLLOUT;
+    pollfds[0].revents = 0;
+#ifdef _WIN32
+    const int n_ready = poll(pollfds, 1, remaining_msecs < NETISLANDS_STOP_CHECK_MSECS
+                             ? (int) remaining_msecs : NETISLANDS_STOP_CHECK_MSECS);
+#else
+    pollfds[1].fd = island->counters->stop_fds[0]; // wakes us up when the island is destroyed
+    pollfds[1].events = POLLIN;
+    pollfds[1].revents = 0;
+    const int n_ready = poll(pollfds, 2, (int) remaining_msecs);
+#endif
+    if (n_ready > 0 && pollfds[0].revents != 0) {
+      return EXIT_SUCCESS;
+    } else if (n_ready < 0 && errno != EINTR) {
+      break;
+    }
+  }
+  return EXIT_FAILURE;
+}
+
+static int open_stop_fds(int stop_fds[2]) {
+#if defined(_WIN32)
+  stop_fds[0] = stop_fds[1] = -1; // sockets only in the poll set, waits check stopping periodically
+  return EXIT_SUCCESS;
+#elif defined(__linux__)
+  if ((stop_fds[0] = stop_fds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+#else
+  if (pipe(stop_fds) == -1) {
+    stop_fds[0] = stop_fds[1] = -1;
+    return EXIT_FAILURE;
+  }
+  fcntl(stop_fds[0], F_SETFL, fcntl(stop_fds[0], F_GETFL, 0) | O_NONBLOCK);
+  fcntl(stop_fds[1], F_SETFL, fcntl(stop_fds[1], F_GETFL, 0) | O_NONBLOCK);
+  return EXIT_SUCCESS;
+#endif
+}
+
+// make the stop fd readable for good, waking up every wait_writable of the island...
+static void signal_stop_fds(const int stop_fds[2]) {
+#if defined(__linux__)
+  const uint64_t one = 1;
+  if (stop_fds[1] != -1 && write(stop_fds[1], &one, sizeof(one)) == -1) {
+    // counter saturated, readable anyway
+  }
+#elif !defined(_WIN32)
+  const char byte = 0;
+  if (stop_fds[1] != -1 && write(stop_fds[1], &byte, 1) == -1) {
+    // pipe full, readable anyway
+  }
+#else
+  (void) stop_fds;
+#endif
+}
+
+static void close_stop_fds(const int stop_fds[2]) {
+  if (stop_fds[0] != -1) {
+    close(stop_fds[0]);
+    if (stop_fds[1] != stop_fds[0]) {
+      close(stop_fds[1]);
+    }
+  }
+}
+
+static long send_segments(const int sockfd, Segment *segments, const int n_segments) {
+#ifdef _WIN32
+  DWORD bytes_sent;
+  return WSASend(sockfd, segments, n_segments, &bytes_sent, 0, NULL, NULL) == 0 ? (long) bytes_sent : -1;
+#else
+  struct msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = segments;
+  message.msg_iovlen = n_segments;
+  return (long) sendmsg(sockfd, &message, NETISLANDS_SEND_FLAGS);
+#endif
+}
+
+// send segments with as few system calls as the socket buffer allows. sockets are non-blocking, a
+// send fails if the receiver takes no data for NETISLANDS_SEND_TIMEOUT_MSECS or the island is
+// destroyed...
+static int send_all_segments(const int sockfd, Segment *segments, int n_segments, const Netislands_Island *island) {
+  Segment *next_segment = segments;
+  while (n_segments > 0) {
+    long bytes_sent = send_segments(sockfd, next_segment, n_segments);
+    if (bytes_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (wait_writable(sockfd, island, NETISLANDS_SEND_TIMEOUT_MSECS) == EXIT_FAILURE) {
+        return EXIT_FAILURE;
+      }
+      continue;
+    } else if (bytes_sent < 0) {
+#ifdef NETISLANDS_DEBUG
+      perror("sendmsg");
+#endif
+      return EXIT_FAILURE;
+    } else if (bytes_sent == 0) {
+#ifdef NETISLANDS_DEBUG
+      fprintf(stderr, "Socket closed by receiving neighbor, ignoring. (%s line# %d)\n", __FILE__, __LINE__);
+#endif
+      break; // socket closed by server
+    }
+    // partial write, skip the segments sent completely and resume within the next one...
+    while (n_segments > 0 && bytes_sent >= (long) SEGMENT_LENGTH(*next_segment)) {
+      bytes_sent -= (long) SEGMENT_LENGTH(*next_segment);
+      next_segment++;
+      n_segments--;
+    }
+    if (n_segments > 0) {
+      SEGMENT_BASE(*next_segment) = (char *) SEGMENT_BASE(*next_segment) + bytes_sent;
+      SEGMENT_LENGTH(*next_segment) -= bytes_sent;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// send all segments of a frame with one system call (unless the socket buffer is full), so that
+// small frames leave in a single TCP segment...
+static int send_frame(const int sockfd, const Frame *frame) {
+  Segment segments[NETISLANDS_FRAME_SEGMENTS];
+  int n_segments = 0;
+  set_segment(&segments[n_segments++], NETISLANDS_PROTOCOL_ID NETISLANDS_PROTOCOL_VERSION,
+              NETISLANDS_PROTOCOL_ID_LENGTH + NETISLANDS_PROTOCOL_VERSION_LENGTH);
+  set_segment(&segments[n_segments++], frame->tag, NETISLANDS_TAG_LENGTH);
+  char sender_port[NETISLANDS_SENDER_PORT_LENGTH];
+  encode_uint32((uint32_t) frame->island->port, sender_port);
+  set_segment(&segments[n_segments++], sender_port, NETISLANDS_SENDER_PORT_LENGTH);
+  if (frame->payload_length > 0) {
+    set_segment(&segments[n_segments++], frame->payload, frame->payload_length);
+  }
+  if (frame->values_length > 0) {
+    set_segment(&segments[n_segments++], frame->values, frame->values_length);
+  }
+  return send_all_segments(sockfd, segments, n_segments, frame->island);
+}
+
+// impair the link to a neighbor as configured by netislands_set_link_emulation, returns
+// EMULATION_DELIVER if the frame should be sent after delay_usecs...
+static EmulationVerdict emulate_link(const Neighbor *neighbor, const Frame *frame, long long *delay_usecs) {
+  const long frame_length = NETISLANDS_PROTOCOL_HEADER_LENGTH + frame->payload_length + frame->values_length;
+  const EmulationVerdict verdict = emulation_apply(frame->island->port, neighbor->port, frame_length, delay_usecs);
+#ifdef NETISLANDS_DEBUG
+  if (verdict != EMULATION_DELIVER) {
+    fprintf(stderr, "emulate_link: %s frame from port %d to %s:%d. (%s line# %d)\n",
+            verdict == EMULATION_LOSE ? "Lost" : "Refused", frame->island->port, neighbor->hostname, neighbor->port,
+            __FILE__, __LINE__);
+  }
+#endif
+  return verdict;
+}
+
+// create a non-blocking client socket connected to a neighbor, returns -1 on failure. gives up
+// after NETISLANDS_CONNECT_TIMEOUT_MSECS or when the island is destroyed...
+static int connect_neighbor(const Neighbor *neighbor, const Netislands_Island *island) {
+  int sockfd;
+  if ((sockfd = socket(neighbor->address.ss_family, SOCK_STREAM, IPPROTO_TCP)) == -1) {
+#ifdef NETISLANDS_DEBUG
+    perror("socket");
+#endif
+    return -1;
+  }
+  set_client_socket_options(sockfd, &island->socket_options);
+  if (set_nonblocking(sockfd) == EXIT_FAILURE) {
+    close(sockfd);
+    return -1;
+  }
+  if (connect(sockfd, (const struct sockaddr *)&neighbor->address, neighbor->address_length) == -1) {
+    int error = errno;
+    if (error == EINPROGRESS || error == EWOULDBLOCK) {
+      socklen_t error_length = sizeof(error);
+      error = wait_writable(sockfd, island, NETISLANDS_CONNECT_TIMEOUT_MSECS) == EXIT_FAILURE ? ETIMEDOUT
+        : getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &error_length) == -1 ? errno : error;
+    }
+    if (error != 0) {
+#ifdef NETISLANDS_DEBUG
+      fprintf(stderr, "connect: %s (%s line# %d)\n", strerror(error), __FILE__, __LINE__);
+#endif
+      close(sockfd);
+      return -1;
+    }
+  }
+  return sockfd;
+}
+
+static int connect_send_close_now(const Neighbor *neighbor, const Frame *frame) {
+  int sockfd;
+
+  // create client socket and connect to neighbor...
+  if ((sockfd = connect_neighbor(neighbor, frame->island)) == -1) {
+    return EXIT_FAILURE;
+  }
+
+  // send protocol header, tag and message data...
+  if (send_frame(sockfd, frame) == EXIT_FAILURE) {
+    close(sockfd);
+    return EXIT_FAILURE;
+  }
+
+  // close connection...
+  // TODO does sockfd need to be closed?...
+  if (close(sockfd) == -1) {
+#ifdef NETISLANDS_DEBUG
+    perror("connect_send_close_now: close sockfd");
+#endif
+    //return EXIT_FAILURE;
+    return EXIT_SUCCESS; // ignore error
+  }
+  return EXIT_SUCCESS;
+}
+
+// a frame delayed by link emulation, with copies of the neighbor address and the frame data...
+typedef struct {
+  Neighbor neighbor;
+  Frame frame;
+  char data[]; // payload and values
+} DelayedFrame;
+
+static void deliver_delayed_frame(void *arg, const int cancelled) {
+  DelayedFrame *delayed = (DelayedFrame *) arg;
+  if (!cancelled) {
+    connect_send_close_now(&delayed->neighbor, &delayed->frame); // the sender has counted the send already
+  }
+  free(delayed);
+}
+
+static int connect_send_close(const Neighbor *neighbor, const Frame *frame) {
+  if (emulation_enabled()) {
+    long long delay_usecs;
+    const EmulationVerdict verdict = emulate_link(neighbor, frame, &delay_usecs);
+    if (verdict == EMULATION_REFUSE) {
+      return EXIT_FAILURE;
+    } else if (verdict == EMULATION_LOSE) {
+      return EXIT_SUCCESS; // the sender does not notice
+    }
+    if (delay_usecs > 0) { // hand a copy to the delivery thread of the link, don't keep the sender waiting
+      DelayedFrame *delayed = (DelayedFrame *) malloc(sizeof(DelayedFrame) + frame->payload_length + frame->values_length);
+      copy_neighbor_address(&delayed->neighbor, neighbor);
+      delayed->frame = *frame;
+      if (frame->payload_length > 0) {
+        memcpy(delayed->data, frame->payload, frame->payload_length);
+      }
+      delayed->frame.payload = delayed->data;
+      if (frame->values_length > 0) {
+        memcpy(delayed->data + frame->payload_length, frame->values, frame->values_length);
+        delayed->frame.values = delayed->data + frame->payload_length;
+      }
+      if (emulation_schedule(frame->island->port, neighbor->port, delay_usecs, EMULATION_MAX_PENDING_DELIVERIES,
+                             frame->island, &deliver_delayed_frame, delayed) == EXIT_FAILURE) {
+        free(delayed);
+        return EXIT_FAILURE; // link congested
+      }
+      return EXIT_SUCCESS;
+    }
+  }
+  return connect_send_close_now(neighbor, frame);
+}
+
+static void remove_failed_neighbors(const Netislands_Island *island) {
+  if (island->max_failures == 0) { // do nothing when neighbor removal is disabled
+    return;
+  }
+  // this assumes that we have a mutex lock on neighbor_queue!
+  Queue *neighbor_queue = island->neighbor_queue;
+  const unsigned max_failures = island->max_failures;
+  long failed_neighbor_index;
+  Neighbor *failed_neighbors = NULL;
+  for (;;) { 
+    // search for a failed neighbor...
+    failed_neighbor_index = -1;
+    long current_index = 0;
+    for (QueueNode *iterator = neighbor_queue->front; iterator != NULL; iterator = iterator->next) {
+      const Neighbor *current_neighbor = (const Neighbor *) iterator->data; 
+      if (__atomic_load_n(&current_neighbor->failure_count, __ATOMIC_RELAXED) >= max_failures) {
+        failed_neighbor_index = current_index;
         break;
       } else {
         current_index++;
       }
     }
-    if (failed_neighbor_index != -1) { // failed neighbor found, remove from queue...
-      Neighbor *failed_neighbor;
-      queue_remove_index(neighbor_queue, failed_neighbor_index, (void **) &failed_neighbor); 
-#ifdef NETISLANDS_DEBUG
-      fprintf(stderr, "Removed failed neighbor %s:%d. (failure count = %u)\n",
-              failed_neighbor->hostname, failed_neighbor->port, failed_neighbor->failure_count);
-#endif
-      free(failed_neighbor);
-    } else { // no failed_neighbor found, break from loop
-      break;
+    if (failed_neighbor_index != -1) { // failed neighbor found, remove from queue...
+      Neighbor *failed_neighbor;
+      queue_remove_index(neighbor_queue, failed_neighbor_index, (void **) &failed_neighbor); 
+      Netislands_Neighbor_Index *index = island->neighbor_index;
+      const long position = neighbor_index_position(index, failed_neighbor->id);
+      memmove(index->neighbors + position, index->neighbors + position + 1,
+              (index->length - position - 1) * sizeof(Neighbor *));
+      index->length--;
+#ifdef NETISLANDS_DEBUG
+      fprintf(stderr, "Removed failed neighbor %s:%d. (failure count = %u)\n",
+              failed_neighbor->hostname, failed_neighbor->port, failed_neighbor->failure_count);
+#endif
+      // snapshot readers may still send to it, it is freed when they are done...
+      failed_neighbor->removed = 1;
+      while (failed_neighbor->outbound_length > 0) {
+        release_outbound_frame(neighbor_dequeue_frame(island, failed_neighbor));
+      }
+      failed_neighbor->next_retired = failed_neighbors;
+      failed_neighbors = failed_neighbor;
+    } else { // no failed_neighbor found, break from loop
+      break;
+    }
+  }
+  if (failed_neighbors != NULL) { // publish the remaining neighbors and retire the removed ones with the old snapshot
+    const unsigned long long retire_epoch = island_publish_snapshot(island);
+    while (failed_neighbors != NULL) {
+      Neighbor *next = failed_neighbors->next_retired;
+      failed_neighbors->retire_epoch = retire_epoch;
+      failed_neighbors->next_retired = island->snapshots->retired_neighbors;
+      island->snapshots->retired_neighbors = failed_neighbors;
+      failed_neighbors = next;
+    }
+    free_retired_snapshots(island);
+  }
+}
+
+// wait before retrying a join, returns 1 if the join was cancelled meanwhile...
+static int join_wait_retry(Join *join, const unsigned attempt) {
+  // exponential backoff with jitter in [0.5, 1.5), so that islands started together spread out...
+  const long long base_msecs = (long long) join->retry_msecs << (attempt < 16 ? attempt : 16);
+  const long long delay_msecs = base_msecs / 2 + (long long) (island_random_next(join->island) % (uint64_t) (base_msecs + 1));
+  struct timespec deadline;
+  timespec_get(&deadline, TIME_UTC);
+  deadline.tv_sec += (time_t) (delay_msecs / 1000);
+  deadline.tv_nsec += (long) (delay_msecs % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+  mtx_lock(&join->mutex);
+  while (!join->cancelled && cnd_timedwait(&join->cancel, &join->mutex, &deadline) == thrd_success) {
+  }
+  const int cancelled = join->cancelled;
+  mtx_unlock(&join->mutex);
+  return cancelled;
+}
+
+static int join_worker_main(void *args) {
+  Join *join = (Join *) args;
+  const Frame frame = {NETISLANDS_JOIN_TAG, join->message, strlen(join->message) + 1, NULL, 0, join->island}; // include the terminating \0
+  long i;
+  while ((i = __atomic_fetch_add(&join->next_neighbor, 1, __ATOMIC_RELAXED)) < join->n_neighbors) {
+    for (unsigned attempt = 0; ; attempt++) {
+      if (connect_send_close(&join->neighbors[i], &frame) == EXIT_SUCCESS) {
+        break;
+      }
+      if (attempt == join->retries || join_wait_retry(join, attempt)) {
+        join->failed[i] = 1;
+#ifdef NETISLANDS_DEBUG
+        fprintf(stderr, "join_worker_main: Failed to join neighbor %s:%d. (%u attempts)\n",
+                join->neighbors[i].hostname, join->neighbors[i].port, attempt + 1);
+#endif
+        break;
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// send the join announcements in parallel, then count a failure for each neighbor that could not
+// be reached...
+static int join_main(void *args) {
+  Join *join = (Join *) args;
+  const Netislands_Island *island = join->island;
+  const unsigned n_threads = (long) join->parallelism < join->n_neighbors ? join->parallelism : (unsigned) join->n_neighbors;
+  thrd_t *threads = (thrd_t *) malloc((n_threads + 1) * sizeof(thrd_t));
+  unsigned n_started = 0;
+  while (n_started + 1 < n_threads && thrd_create(&threads[n_started], &join_worker_main, join) == thrd_success) {
+    n_started++;
+  }
+  join_worker_main(join); // this thread helps
+  for (unsigned i = 0; i < n_started; i++) {
+    thrd_join(threads[i], NULL);
+  }
+  free(threads);
+  mtx_lock(island->neighbor_queue_mutex);
+  for (long i = 0; i < join->n_neighbors; i++) {
+    const long position = neighbor_index_position(island->neighbor_index, join->neighbors[i].id);
+    if (join->failed[i] && position != -1) {
+      __atomic_add_fetch(&island->neighbor_index->neighbors[position]->failure_count, 1, __ATOMIC_RELAXED);
+    }
+  }
+  remove_failed_neighbors(island);
+  mtx_unlock(island->neighbor_queue_mutex);
+  return EXIT_SUCCESS;
+}
+
+static void free_join(Join *join) {
+  free(join->neighbors);
+  free(join->failed);
+  mtx_destroy(&join->mutex);
+  cnd_destroy(&join->cancel);
+  free(join);
+}
+
+// announce an island to its neighbors, in the background if the config says so...
+static int island_send_join(Netislands_Island *island, const Netislands_Config *config) {
+  Join *join = (Join *) malloc(sizeof(Join));
+  join->island = island;
+  sprintf(join->message, "%d", island->port); // send port number
+  int slot;
+  const NeighborSnapshot *snapshot = island_enter_snapshot(island, &slot);
+  join->n_neighbors = snapshot->length;
+  join->neighbors = (Neighbor *) malloc((snapshot->length + 1) * sizeof(Neighbor));
+  for (long i = 0; i < snapshot->length; i++) {
+    copy_neighbor_address(&join->neighbors[i], snapshot->neighbors[i]);
+  }
+  island_leave_snapshot(island, slot);
+  join->failed = (int *) calloc(join->n_neighbors + 1, sizeof(int));
+  join->next_neighbor = 0;
+  join->parallelism = config->join_parallelism > 0 ? config->join_parallelism : 1;
+  join->retries = config->join_retries;
+  join->retry_msecs = config->join_retry_msecs;
+  mtx_init(&join->mutex, mtx_plain);
+  cnd_init(&join->cancel);
+  join->cancelled = 0;
+  if (config->join_async) {
+    if (thrd_create(&join->thread, &join_main, join) != thrd_success) {
+      free_join(join);
+      return EXIT_FAILURE;
+    }
+    island->join = join;
+  } else {
+    join_main(join);
+    free_join(join);
+  }
+  return EXIT_SUCCESS;
+}
+
+// stop retrying joins still sent in the background and wait for the ones in flight...
+static void island_cancel_join(Netislands_Island *island) {
+  if (NULL == island->join) {
+    return;
+  }
+  mtx_lock(&island->join->mutex);
+  island->join->cancelled = 1;
+  cnd_broadcast(&island->join->cancel);
+  mtx_unlock(&island->join->mutex);
+  thrd_join(island->join->thread, NULL);
+  free_join(island->join);
+  island->join = NULL;
+}
+
+static int neighbor_accepts_data(Neighbor *neighbor) {
+  const int fill_level = __atomic_load_n(&neighbor->remote_fill_level, __ATOMIC_RELAXED);
+  if (fill_level <= NETISLANDS_BACKPRESSURE_LOW_WATERMARK
+      || monotonic_msecs() >= __atomic_load_n(&neighbor->remote_fill_level_expiry, __ATOMIC_RELAXED)) { // no (recent) backpressure
+    return 1;
+  }
+  if (fill_level >= NETISLANDS_BACKPRESSURE_HIGH_WATERMARK) { // message would likely be dropped
+    return 0;
+  }
+  // throttle the send rate linearly between low and high watermark...
+  const long credit = 1000L * (NETISLANDS_BACKPRESSURE_HIGH_WATERMARK - fill_level)
+    / (NETISLANDS_BACKPRESSURE_HIGH_WATERMARK - NETISLANDS_BACKPRESSURE_LOW_WATERMARK);
+  if (__atomic_add_fetch(&neighbor->send_credit, credit, __ATOMIC_RELAXED) >= 1000) {
+    __atomic_sub_fetch(&neighbor->send_credit, 1000, __ATOMIC_RELAXED);
+    return 1;
+  }
+  return 0;
+}
+
+// count a data send, returns 1 if the neighbor failed too often and should be removed...
+static int count_data_send(const Netislands_Island *island, Neighbor *neighbor, const int ret) {
+  if (ret == EXIT_SUCCESS) {
+    __atomic_fetch_add(&island->stats->messages_sent, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  __atomic_fetch_add(&island->stats->send_failures, 1, __ATOMIC_RELAXED);
+  const unsigned failure_count = __atomic_add_fetch(&neighbor->failure_count, 1, __ATOMIC_RELAXED);
+#ifdef NETISLANDS_DEBUG
+  fprintf(stderr, "send_data_to_neighbor: Failed to send to neighbor %s:%d. (failure count = %u)\n",
+          neighbor->hostname, neighbor->port, failure_count);
+#endif
+  return island->max_failures > 0 && failure_count >= island->max_failures;
+}
+
+static void send_data_to_neighbor(void *element, void *args) {
+  Neighbor *neighbor = (Neighbor *) element;
+  DataSend *send = (DataSend *) args;
+  if (!neighbor_accepts_data(neighbor)) {
+    __atomic_fetch_add(&send->island->stats->sends_skipped, 1, __ATOMIC_RELAXED);
+#ifdef NETISLANDS_DEBUG
+    fprintf(stderr, "send_data_to_neighbor: Skipped overloaded neighbor %s:%d. (fill level = %d)\n",
+            neighbor->hostname, neighbor->port, neighbor->remote_fill_level);
+#endif
+    return;
+  }
+  if (NULL == send->outbound_frame) { // send synchronously
+    if (count_data_send(send->island, neighbor, connect_send_close(neighbor, send->frame))) {
+      send->remove_failed = 1;
+    }
+  } else if (neighbor_enqueue_frame(send->island, neighbor, send->outbound_frame, !send->background) == EXIT_FAILURE) {
+    if (send->n_blocked == send->blocked_capacity) { // retry when the queue has room again
+      send->blocked_capacity = send->blocked_capacity ? 2 * send->blocked_capacity : 8;
+      send->blocked_ids = (unsigned *) realloc(send->blocked_ids, send->blocked_capacity * sizeof(unsigned));
+    }
+    send->blocked_ids[send->n_blocked++] = neighbor->id;
+  }
+}
+
+static void begin_data_send(DataSend *send, const Netislands_Island *island, const Frame *frame, const int background) {
+  send->frame = frame;
+  send->island = island;
+  send->background = background;
+  send->outbound_frame = background || island->outbound->data_queued ? new_outbound_frame(frame, OUTBOUND_DATA) : NULL;
+  send->blocked_ids = NULL;
+  send->n_blocked = 0;
+  send->blocked_capacity = 0;
+  send->remove_failed = 0;
+}
+
+// send a data frame to neighbors of a snapshot. synchronous sends run without the neighbor_queue
+// lock, queued sends take it only to fill the outbound queues...
+static void send_data_to_neighbors(DataSend *send, Neighbor *const *neighbors, const long n_neighbors) {
+  if (NULL == send->outbound_frame) {
+    for (long i = 0; i < n_neighbors; i++) {
+      send_data_to_neighbor(neighbors[i], (void *) send);
+    }
+    return;
+  }
+  mtx_lock(send->island->neighbor_queue_mutex);
+  for (long i = 0; i < n_neighbors; i++) {
+    if (!neighbors[i]->removed) {
+      send_data_to_neighbor(neighbors[i], (void *) send);
+    }
+  }
+  mtx_unlock(send->island->neighbor_queue_mutex);
+}
+
+// wait for room in the outbound queues of blocked neighbors, then drop the frame for the neighbors
+// still blocked after the timeout. removes the neighbors that failed too often...
+static void end_data_send(DataSend *send) {
+  const Netislands_Island *island = send->island;
+  const int locked = send->n_blocked > 0 || send->remove_failed;
+  if (locked) {
+    mtx_lock(island->neighbor_queue_mutex);
+    remove_failed_neighbors(island);
+  }
+  if (send->n_blocked > 0) {
+    struct timespec deadline;
+    timespec_get(&deadline, TIME_UTC);
+    deadline.tv_sec += island->outbound->block_timeout_msecs / 1000;
+    deadline.tv_nsec += (long) (island->outbound->block_timeout_msecs % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while (send->n_blocked > 0 && !__atomic_load_n(&island->outbound->exit_flag, __ATOMIC_SEQ_CST)
+           && cnd_timedwait(&island->outbound->space_available, island->neighbor_queue_mutex, &deadline) == thrd_success) {
+      long n_still_blocked = 0;
+      for (long i = 0; i < send->n_blocked; i++) {
+        const long position = neighbor_index_position(island->neighbor_index, send->blocked_ids[i]);
+        if (position != -1
+            && neighbor_enqueue_frame(island, island->neighbor_index->neighbors[position], send->outbound_frame, 1) == EXIT_FAILURE) {
+          send->blocked_ids[n_still_blocked++] = send->blocked_ids[i];
+        }
+      }
+      send->n_blocked = n_still_blocked;
+    }
+    for (long i = 0; i < send->n_blocked; i++) { // timed out
+      const long position = neighbor_index_position(island->neighbor_index, send->blocked_ids[i]);
+      if (position != -1) {
+        island->neighbor_index->neighbors[position]->outbound_dropped++;
+        __atomic_fetch_add(&island->stats->outbound_dropped, 1, __ATOMIC_RELAXED);
+      }
+    }
+    free(send->blocked_ids);
+  }
+  if (locked) {
+    mtx_unlock(island->neighbor_queue_mutex);
+  }
+  if (send->outbound_frame != NULL) {
+    release_outbound_frame(send->outbound_frame);
+  }
+}
+
+// send one queued frame of a neighbor at a time and put the neighbor back into the deque while it
+// has more. frames are sent without holding the neighbor_queue lock, to a copy of their neighbor's
+// address...
+static int island_sender_main(void *args) {
+  Sender *sender = (Sender *) args;
+  const Netislands_Island *island = sender->island;
+  Outbound *outbound = island->outbound;
+  while (!__atomic_load_n(&outbound->exit_flag, __ATOMIC_SEQ_CST)) {
+    unsigned neighbor_id;
+    if (sender_take(sender, &neighbor_id) == EXIT_FAILURE) {
+      sender_wait(outbound);
+      continue;
+    }
+    mtx_lock(island->neighbor_queue_mutex);
+    long position = neighbor_index_position(island->neighbor_index, neighbor_id);
+    if (position == -1) { // removed neighbor
+      mtx_unlock(island->neighbor_queue_mutex);
+      continue;
+    }
+    Neighbor *neighbor = island->neighbor_index->neighbors[position];
+    if (neighbor->outbound_length == 0) {
+      neighbor->outbound_scheduled = 0;
+      mtx_unlock(island->neighbor_queue_mutex);
+      continue;
+    }
+    OutboundFrame *outbound_frame = neighbor_dequeue_frame(island, neighbor);
+    Neighbor target;
+    copy_neighbor_address(&target, neighbor);
+    mtx_unlock(island->neighbor_queue_mutex);
+    const Frame frame = {
+      outbound_frame->tag, outbound_frame->data, outbound_frame->payload_length,
+      outbound_frame->data + outbound_frame->payload_length, outbound_frame->values_length, island
+    };
+    const int ret = connect_send_close(&target, &frame);
+    const OutboundKind kind = outbound_frame->kind;
+    release_outbound_frame(outbound_frame);
+    mtx_lock(island->neighbor_queue_mutex);
+    // the neighbor may have been removed meanwhile...
+    position = neighbor_index_position(island->neighbor_index, neighbor_id);
+    if (position != -1) {
+      neighbor = island->neighbor_index->neighbors[position];
+      neighbor->outbound_scheduled = 0;
+      if (kind == OUTBOUND_SERVED) {
+        __atomic_fetch_add(ret == EXIT_SUCCESS ? &island->stats->messages_served : &island->stats->send_failures,
+                           1, __ATOMIC_RELAXED);
+      }
+      if (kind == OUTBOUND_DATA && count_data_send(island, neighbor, ret)) { // failed too often
+        remove_failed_neighbors(island);
+      } else if (neighbor->outbound_length > 0) { // keep it, we are awake anyway
+        neighbor->outbound_scheduled = 1;
+        sender_push(sender, neighbor_id);
+      }
+    }
+    mtx_unlock(island->neighbor_queue_mutex);
+  }
+  return EXIT_SUCCESS;
+}
+
+static void island_stop_sender(Netislands_Island *island) {
+  Outbound *outbound = island->outbound;
+  mtx_lock(island->neighbor_queue_mutex);
+  __atomic_store_n(&outbound->exit_flag, 1, __ATOMIC_SEQ_CST);
+  cnd_broadcast(&outbound->space_available);
+  mtx_unlock(island->neighbor_queue_mutex);
+  mtx_lock(&outbound->idle_mutex);
+  cnd_broadcast(&outbound->frames_available);
+  mtx_unlock(&outbound->idle_mutex);
+  for (unsigned i = 0; i < outbound->n_started; i++) {
+    thrd_join(outbound->senders[i].thread, NULL);
+  }
+}
+
+static void free_outbound(Outbound *outbound) {
+  for (unsigned i = 0; i < outbound->n_senders; i++) {
+    mtx_destroy(&outbound->senders[i].mutex);
+    free(outbound->senders[i].neighbor_ids);
+  }
+  free(outbound->senders);
+  mtx_destroy(&outbound->idle_mutex);
+  cnd_destroy(&outbound->frames_available);
+  cnd_destroy(&outbound->space_available);
+  free(outbound);
+}
+
+// create the outbound queues and the deques of the sender threads. without queued data messages,
+// the outbound queues only take the frames sent in the background (like relays), which one sender
+// thread keeps up with by default...
+static void island_init_outbound(Netislands_Island *island, const Netislands_Config *config) {
+  Outbound *outbound = (Outbound *) malloc(sizeof(Outbound));
+  outbound->data_queued = config->outbound_queue_length > 0;
+  outbound->capacity = outbound->data_queued ? config->outbound_queue_length : NETISLANDS_BACKGROUND_QUEUE_LENGTH;
+  outbound->policy = config->outbound_policy;
+  outbound->block_timeout_msecs = config->outbound_block_msecs;
+  outbound->n_senders = config->sender_threads > 0 ? config->sender_threads
+    : outbound->data_queued ? n_processors() : 1;
+  outbound->senders = (Sender *) calloc(outbound->n_senders, sizeof(Sender));
+  outbound->n_started = 0;
+  outbound->n_scheduled = 0;
+  outbound->n_idle = 0;
+  outbound->exit_flag = 0;
+  mtx_init(&outbound->idle_mutex, mtx_plain);
+  cnd_init(&outbound->frames_available);
+  cnd_init(&outbound->space_available);
+  island->outbound = outbound;
+  for (unsigned i = 0; i < outbound->n_senders; i++) {
+    outbound->senders[i].island = island;
+    mtx_init(&outbound->senders[i].mutex, mtx_plain);
+  }
+}
+
+// start the sender threads, frames queued before are sent right away...
+static int island_start_sender(Netislands_Island *island) {
+  Outbound *outbound = island->outbound;
+  for (unsigned i = 0; i < outbound->n_senders; i++) {
+    if (thrd_create(&outbound->senders[i].thread, &island_sender_main, &outbound->senders[i]) != thrd_success) {
+      return EXIT_FAILURE; // the started ones are stopped by island_destroy
+    }
+    outbound->n_started++;
+  }
+  return EXIT_SUCCESS;
+}
+
+int netislands_enable_shared_reactor(const unsigned n_threads) {
+  call_once(&netislands_mutex_once, &netislands_mutex_init);
+  const unsigned n = n_threads > 0 ? n_threads : n_processors();
+  mtx_lock(&netislands_mutex);
+  if (shared_reactor != NULL && shared_reactor->n_threads != n) { // cannot resize a running reactor
+    mtx_unlock(&netislands_mutex);
+    return EXIT_FAILURE;
+  }
+  shared_reactor_threads = n;
+  mtx_unlock(&netislands_mutex);
+  return EXIT_SUCCESS;
+}
+
+int netislands_disable_shared_reactor(void) {
+  call_once(&netislands_mutex_once, &netislands_mutex_init);
+  mtx_lock(&netislands_mutex);
+  shared_reactor_threads = 0; // islands already served by the shared reactor keep it
+  mtx_unlock(&netislands_mutex);
+  return EXIT_SUCCESS;
+}
+
+// attach the island's server socket to the shared reactor or to a reactor of its own...
+static int island_attach_reactor(Netislands_Island *island, const Netislands_Config *config) {
+  mtx_lock(&netislands_mutex);
+  const unsigned n_threads = config->reactor_threads > 0 ? (unsigned) config->reactor_threads
+    : config->reactor_threads == 0 ? shared_reactor_threads : 0;
+  if (n_threads > 0) {
+    if (NULL == shared_reactor) {
+      shared_reactor = (Reactor *) malloc(sizeof(Reactor));
+      if (reactor_init(shared_reactor, n_threads, config->poll_timeout_msecs) == EXIT_FAILURE) {
+        free(shared_reactor);
+        shared_reactor = NULL;
+        mtx_unlock(&netislands_mutex);
+        return EXIT_FAILURE;
+      }
+    }
+    n_shared_reactor_islands++;
+    island->reactor = shared_reactor;
+  } else {
+    island->reactor = (Reactor *) malloc(sizeof(Reactor));
+    if (reactor_init(island->reactor, 1, config->poll_timeout_msecs) == EXIT_FAILURE) {
+      free(island->reactor);
+      island->reactor = NULL;
+      mtx_unlock(&netislands_mutex);
+      return EXIT_FAILURE;
     }
   }
+  mtx_unlock(&netislands_mutex);
+  const ReactorListenerOptions options = {
+    config->max_message_length, config->socket_options.tcp_quickack, config->inbound_messages_per_sec,
+    config->inbound_bytes_per_sec, &island->stats->messages_rate_limited, NETISLANDS_SENDER_PORT_OFFSET
+  };
+  return reactor_add_listener(island->reactor, island->listenfd, &options, &island_handle_message, &island_handle_stream,
+                              &island_tick, island);
 }
 
-static void island_send_join(const Netislands_Island *island, const char *message) {
-  mtx_lock(island->neighbor_queue_mutex);
-  queue_for_each(island->neighbor_queue, &send_join_to_neighbor, (void *) message);
-  remove_failed_neighbors(island->neighbor_queue, island->max_failures);
-  mtx_unlock(island->neighbor_queue_mutex);
+static void island_detach_reactor(Netislands_Island *island) {
+  reactor_remove_listener(island->reactor, island->listenfd);
+  mtx_lock(&netislands_mutex);
+  if (island->reactor != shared_reactor) {
+    reactor_destroy(island->reactor);
+    free(island->reactor);
+  } else if (--n_shared_reactor_islands == 0) {
+    reactor_destroy(shared_reactor);
+    free(shared_reactor);
+    shared_reactor = NULL;
+  }
+  mtx_unlock(&netislands_mutex);
+  island->reactor = NULL;
 }
 
-static void send_data_to_neighbor(void *element, void *args) {
-  Neighbor *neighbor = (Neighbor *) element;
-  const char *message = (char *) args;
-  const long message_length = strlen(message) + 1; // include the terminating \0
-  const int ret = connect_send_close(neighbor->hostname, neighbor->port, NETISLANDS_DATA_TAG, message, message_length);
-  if (ret == EXIT_FAILURE) {
-    neighbor->failure_count++;
-#ifdef NETISLANDS_DEBUG
-    fprintf(stderr, "send_data_to_neighbor: Failed to send to neighbor %s:%d. (failure count = %u)\n",
-            neighbor->hostname, neighbor->port, neighbor->failure_count);
-#endif
-  }
+void island_config_init(Netislands_Config *config,
+                        const int port,
+                        const long max_message_queue_length,
+                        const unsigned max_failures) {
+  memset(config, 0, sizeof(Netislands_Config));
+  config->port = port;
+  config->max_message_queue_length = max_message_queue_length;
+  config->max_failures = max_failures;
+  config->message_queue_mode = NETISLANDS_QUEUE_FIFO;
+  config->journal_path = NULL;
+  config->backlog = NETISLANDS_BACKLOG;
+  config->max_message_length = NETISLANDS_SERVER_BUFFER_LENGTH;
+  config->poll_timeout_msecs = NETISLANDS_POLL_TIMEOUT_MSECS;
+  config->join_parallelism = NETISLANDS_JOIN_PARALLELISM;
+  config->join_retry_msecs = NETISLANDS_JOIN_RETRY_MSECS;
+  config->outbox_length = NETISLANDS_OUTBOX_LENGTH;
 }
 
 int island_init(Netislands_Island *island,
@@ -446,118 +2600,1007 @@ int island_init(Netislands_Island *island,
                 const int neighbor_ports[n_neighbors],
                 const long max_message_queue_length,
                 const unsigned max_failures) {
+  Netislands_Config config;
+  island_config_init(&config, port, max_message_queue_length, max_failures);
+  return island_init_with_config(island, &config, n_neighbors, neighbor_hostnames, neighbor_ports);
+}
+
+int island_init_with_config(Netislands_Island *island,
+                            const Netislands_Config *config,
+                            const unsigned n_neighbors,
+                            const char *neighbor_hostnames[n_neighbors],
+                            const int neighbor_ports[n_neighbors]) {
+  const int port = config->port;
   // maybe initialize network...
+  call_once(&netislands_mutex_once, &netislands_mutex_init);
+  mtx_lock(&netislands_mutex);
   if (0 == n_islands) {
     netislands_init();
   }
   n_islands++;
+  mtx_unlock(&netislands_mutex);
   // init port...
   island->port = port; 
   // init neighbor queue...
   Queue *neighbor_queue = malloc(sizeof(Queue));
   queue_init(neighbor_queue);
   island->neighbor_queue = neighbor_queue;
+  Netislands_Neighbor_Index *neighbor_index = malloc(sizeof(Netislands_Neighbor_Index));
+  neighbor_index->neighbors = NULL;
+  neighbor_index->length = 0;
+  neighbor_index->capacity = 0;
+  neighbor_index->next_id = 0;
+  neighbor_index->random_state = (unsigned long long) time(NULL) ^ ((unsigned long long) port << 32);
+  island->neighbor_index = neighbor_index;
   mtx_t *neighbor_queue_mutex = malloc(sizeof(mtx_t));
   mtx_init(neighbor_queue_mutex, mtx_plain);
   island->neighbor_queue_mutex = neighbor_queue_mutex;
+  island->snapshots = (Snapshots *) calloc(1, sizeof(Snapshots));
+  island->snapshots->epoch = 1; // reader slots hold 0 when free
+  mtx_lock(island->neighbor_queue_mutex);
+  island_publish_snapshot(island); // empty
+  mtx_unlock(island->neighbor_queue_mutex);
+  // create the outbound queues before adding neighbors, which get their rings from them. the
+  // sender threads are started once nothing else can fail...
+  island_init_outbound(island, config);
   // init message queue...
   Queue *message_queue = malloc(sizeof(Queue));
   queue_init(message_queue);
   island->message_queue = message_queue;
+  PriorityQueue *message_priority_queue = malloc(sizeof(PriorityQueue));
+  priority_queue_init(message_priority_queue);
+  island->message_priority_queue = message_priority_queue;
+  island->message_queue_mode = config->message_queue_mode;
+  island->journal = NULL;
+  island->journal_flags = 0;
   mtx_t *message_queue_mutex = malloc(sizeof(mtx_t));
   mtx_init(message_queue_mutex, mtx_plain);
   island->message_queue_mutex = message_queue_mutex;
+  // init other members...
+  island->max_message_queue_length = config->max_message_queue_length;
+  island->max_message_queue_bytes = config->max_message_queue_bytes;
+  island->counters = (Counters *) calloc(1, sizeof(Counters));
+  island->counters->stop_fds[0] = island->counters->stop_fds[1] = -1;
+  island->max_failures = config->max_failures;
+  island->advertised_fill_level = 0;
+  island->advertised_fill_level_time = 0;
+  island->timing = config->timing;
+  island->stats = (Netislands_Island_Stats *) calloc(1, sizeof(Netislands_Island_Stats));
+  island->socket_options = config->socket_options;
+  island->forward_ttl = config->forward_ttl < NETISLANDS_MAX_FORWARD_TTL ? config->forward_ttl : NETISLANDS_MAX_FORWARD_TTL;
+  island->origin_id = island_random_next(island) ^ (unsigned long long) monotonic_usecs();
+  island->seen_ids = (unsigned long long *) calloc(NETISLANDS_SEEN_SET_LENGTH, sizeof(unsigned long long));
+  island->dedup_length = config->dedup_length;
+  island->dedup_hashes = config->dedup_length > 0
+    ? (unsigned long long *) calloc(config->dedup_length, sizeof(unsigned long long)) : NULL;
+  island->streams = (Streams *) malloc(sizeof(Streams));
+  mtx_init(&island->streams->mutex, mtx_plain);
+  cnd_init(&island->streams->data_available);
+  cnd_init(&island->streams->delivered);
+  island->streams->incoming = NULL;
+  island->pull = (Pull *) malloc(sizeof(Pull));
+  mtx_init(&island->pull->mutex, mtx_plain);
+  queue_init(&island->pull->outbox);
+  island->pull->outbox_capacity = config->outbox_length;
+  island->pull->outbox_bytes = 0;
+  island->pull->provider = NULL;
+  island->pull->provider_context = NULL;
+  island->listenfd = -1;
+  island->reactor = NULL;
+  island->join = NULL;
+  // from here on, failures unwind what has been built with island_destroy...
+  if (open_stop_fds(island->counters->stop_fds) == EXIT_FAILURE) {
+    fprintf(stderr, "island_init: error opening stop fds.\n");
+    island_destroy(island);
+    return EXIT_FAILURE;
+  }
+  // resolve neighbor hostnames (concurrently and cached)...
+  char (*neighbor_addresses)[RESOLVER_MAX_ADDRESS_LENGTH] = malloc((n_neighbors + 1) * RESOLVER_MAX_ADDRESS_LENGTH);
+  if (resolver_resolve_all(n_neighbors, neighbor_hostnames, neighbor_addresses) == EXIT_FAILURE) {
+    // failed lookups leave an empty address, report the first one...
+    unsigned failed = 0;
+    while (failed < n_neighbors - 1 && neighbor_addresses[failed][0] != '\0') {
+      failed++;
+    }
+    fprintf(stderr, "island_init: error resolving neighbor hostname '%s'.\n",
+            neighbor_hostnames[failed]);
+    free(neighbor_addresses);
+    island_destroy(island);
+    return EXIT_FAILURE;
+  }
   // init neighbors...
   for (unsigned i = 0; i < n_neighbors; i++) {
     Neighbor *new_neighbor = (Neighbor *) malloc(sizeof(Neighbor));
-    // resolve new neighbor hostname...
-    struct hostent *hostname_entries;
-    if ((hostname_entries = gethostbyname(neighbor_hostnames[i])) == NULL) {
+    strcpy(new_neighbor->hostname, neighbor_addresses[i]);
+    init_neighbor(new_neighbor, neighbor_ports[i]);
+    if (init_neighbor_address(new_neighbor) == EXIT_FAILURE) {
       fprintf(stderr, "island_init: error resolving neighbor hostname '%s'.\n",
               neighbor_hostnames[i]);
+      free(new_neighbor);
+      free(neighbor_addresses);
+      island_destroy(island);
       return EXIT_FAILURE;
     }
-    // init neighbor fields...
-    inet_ntop(AF_INET, hostname_entries->h_addr_list[0], new_neighbor->hostname, NETISLANDS_MAX_HOSTNAME_LENGTH);
-    new_neighbor->port = neighbor_ports[i];
-    new_neighbor->failure_count = 0;
     mtx_lock(island->neighbor_queue_mutex);
-    queue_enqueue(island->neighbor_queue, new_neighbor);
+    add_neighbor(island, new_neighbor);
     mtx_unlock(island->neighbor_queue_mutex);
   }
-  // init message buffer by allocating memory on heap...
-  island->message_buffer = malloc(NETISLANDS_SERVER_BUFFER_LENGTH);
-  // init other members...
-  island->exit_flag = 0;
-  island->max_message_queue_length = max_message_queue_length;
-  island->max_failures = max_failures;
-  // init island thread...
-  thrd_t island_thread = (thrd_t) malloc(sizeof(thrd_t));
-  island->thread = island_thread;
-  if (thrd_create(&island->thread, &island_thread_main, island) != thrd_success) {
+  free(neighbor_addresses);
+  // reload pending messages before neighbors can send new ones...
+  if (config->journal_path != NULL
+      && island_open_journal(island, config->journal_path, config->journal_capacity, config->journal_flags) == EXIT_FAILURE) {
+    island_destroy(island);
+    return EXIT_FAILURE;
+  }
+  // init server socket, neighbors can connect as soon as it is listening...
+  if ((island->listenfd = open_server_socket(config)) == -1) {
+    fprintf(stderr, "island_init: error opening server socket on port %d.\n", port);
+    island_destroy(island);
+    return EXIT_FAILURE;
+  }
+  // serve the server socket by a reactor thread...
+  if (island_attach_reactor(island, config) == EXIT_FAILURE) {
 #ifdef NETISLANDS_DEBUG
     perror("thrd_create");
 #endif
+    island_destroy(island);
+    return EXIT_FAILURE;
+  }
+  // send what the reactor has queued meanwhile, and what comes next...
+  if (island_start_sender(island) == EXIT_FAILURE) {
+    fprintf(stderr, "island_init: error starting sender thread.\n");
+    island_destroy(island);
     return EXIT_FAILURE;
   }
   // introduce this island to its neighbors...
-  char port_string[NETISLANDS_MAX_PORT_STRING_LENGTH];
-  sprintf(port_string, "%d", island->port);
-  island_send_join(island, port_string); // send port number
+  if (island_send_join(island, config) == EXIT_FAILURE) {
+    fprintf(stderr, "island_init: error starting join thread.\n");
+    island_destroy(island);
+    return EXIT_FAILURE;
+  }
 
   return EXIT_SUCCESS; 
 }
 
+int island_init_with_topology(Netislands_Island *island,
+                              const unsigned n_hosts,
+                              const char *hostnames[n_hosts],
+                              const int ports[n_hosts],
+                              const unsigned host_index,
+                              const Topology *topology,
+                              const long max_message_queue_length,
+                              const unsigned max_failures) {
+  // compute this island's neighbors from its index in the hosts list...
+  unsigned *neighbor_indices, n_neighbors;
+  if (topology_neighbors(topology, n_hosts, host_index, &neighbor_indices, &n_neighbors) == EXIT_FAILURE) {
+    fprintf(stderr, "island_init_with_topology: cannot create topology for %u hosts.\n", n_hosts);
+    return EXIT_FAILURE;
+  }
+  const char **neighbor_hostnames = (const char **) malloc((n_neighbors + 1) * sizeof(char *));
+  int *neighbor_ports = (int *) malloc((n_neighbors + 1) * sizeof(int));
+  for (unsigned i = 0; i < n_neighbors; i++) {
+    neighbor_hostnames[i] = hostnames[neighbor_indices[i]];
+    neighbor_ports[i] = ports[neighbor_indices[i]];
+  }
+  const int ret = island_init(island, ports[host_index], n_neighbors, neighbor_hostnames, neighbor_ports,
+                              max_message_queue_length, max_failures);
+  free(neighbor_ports);
+  free(neighbor_hostnames);
+  free(neighbor_indices);
+  return ret;
+}
+
+int island_set_message_queue_mode(Netislands_Island *island, const Netislands_Queue_Mode mode) {
+  mtx_lock(island->message_queue_mutex);
+  // move queued messages over to the new queue, messages without priority have priority 0...
+  QueuedMessage *message;
+  if (mode == NETISLANDS_QUEUE_PRIORITY && island->message_queue_mode != NETISLANDS_QUEUE_PRIORITY) {
+    while (queue_dequeue(island->message_queue, (void **) &message) != EXIT_FAILURE) {
+      priority_queue_insert(island->message_priority_queue, message->priority, message);
+    }
+  } else if (mode == NETISLANDS_QUEUE_FIFO && island->message_queue_mode != NETISLANDS_QUEUE_FIFO) {
+    while (priority_queue_remove_max(island->message_priority_queue, NULL, (void **) &message) != EXIT_FAILURE) {
+      queue_enqueue(island->message_queue, message);
+    }
+  }
+  island->message_queue_mode = mode;
+  mtx_unlock(island->message_queue_mutex);
+  return EXIT_SUCCESS;
+}
+
+static int island_send_frame(const Netislands_Island *island, const Frame *frame, const int background) {
+  DataSend send;
+  begin_data_send(&send, island, frame, background);
+  int slot;
+  const NeighborSnapshot *snapshot = island_enter_snapshot(island, &slot);
+  send_data_to_neighbors(&send, snapshot->neighbors, snapshot->length);
+  island_leave_snapshot(island, slot);
+  end_data_send(&send);
+  return EXIT_SUCCESS;
+}
+
+// build a data frame, with an extended header if there are header fields to send. payload must have
+// room for NETISLANDS_MAX_XDATA_HEADER_LENGTH bytes...
+static Frame island_data_frame(const Netislands_Island *island, DataHeader *header, char *payload,
+                               const void *data, const long data_length) {
+  if (island->timing) {
+    header->flags |= NETISLANDS_XDATA_TIMING;
+    header->timestamp = realtime_usecs();
+    header->origin_port = island->port;
+  }
+  if (island->forward_ttl > 0) {
+    header->flags |= NETISLANDS_XDATA_FORWARD;
+    header->origin_id = island->origin_id;
+    header->forward_sequence = __atomic_fetch_add(&island->counters->next_sequence, 1, __ATOMIC_RELAXED);
+    header->ttl = island->forward_ttl;
+  }
+  Frame frame = {NETISLANDS_DATA_TAG, (const char *) data, data_length, NULL, 0, island};
+  if (header->flags != 0) { // the data follows the extended header without being copied
+    frame.tag = NETISLANDS_XDATA_TAG;
+    frame.payload = payload;
+    frame.payload_length = encode_data_header(header, payload);
+    frame.values = (const char *) data;
+    frame.values_length = data_length;
+  }
+  return frame;
+}
+
+int island_send_to(const Netislands_Island *island, const unsigned *neighbor_ids, const unsigned n, const char *message) {
+  DataHeader header;
+  init_data_header(&header, 0);
+  char payload[NETISLANDS_MAX_XDATA_HEADER_LENGTH];
+  const long message_length = strlen(message) + 1; // include the terminating \0
+  const Frame frame = island_data_frame(island, &header, payload, message, message_length);
+  DataSend send;
+  begin_data_send(&send, island, &frame, 0);
+  island_journal_sent_message(island, NETISLANDS_VALUES_BYTES, message, message_length, 0.0);
+  int ret = EXIT_SUCCESS;
+  int slot;
+  const NeighborSnapshot *snapshot = island_enter_snapshot(island, &slot);
+  Neighbor **neighbors = (Neighbor **) malloc((n + 1) * sizeof(Neighbor *));
+  long n_neighbors = 0;
+  for (unsigned i = 0; i < n; i++) {
+    const long position = snapshot_position(snapshot, neighbor_ids[i]);
+    if (position == -1) { // unknown or removed neighbor
+      ret = EXIT_FAILURE;
+      continue;
+    }
+    neighbors[n_neighbors++] = snapshot->neighbors[position];
+  }
+  send_data_to_neighbors(&send, neighbors, n_neighbors);
+  island_leave_snapshot(island, slot);
+  free(neighbors);
+  end_data_send(&send);
+  return ret;
+}
+
+int island_send_random_k(const Netislands_Island *island, const unsigned k, const char *message) {
+  DataHeader header;
+  init_data_header(&header, 0);
+  char payload[NETISLANDS_MAX_XDATA_HEADER_LENGTH];
+  const long message_length = strlen(message) + 1; // include the terminating \0
+  const Frame frame = island_data_frame(island, &header, payload, message, message_length);
+  DataSend send;
+  begin_data_send(&send, island, &frame, 0);
+  island_journal_sent_message(island, NETISLANDS_VALUES_BYTES, message, message_length, 0.0);
+  int slot;
+  const NeighborSnapshot *snapshot = island_enter_snapshot(island, &slot);
+  const long n_samples = (long) k < snapshot->length ? (long) k : snapshot->length;
+  long *samples = (long *) malloc((n_samples + 1) * sizeof(long));
+  Neighbor **neighbors = (Neighbor **) malloc((n_samples + 1) * sizeof(Neighbor *));
+  // sample n_samples distinct neighbor positions uniformly (Floyd's algorithm)...
+  long n_sampled = 0;
+  for (long j = snapshot->length - n_samples; j < snapshot->length; j++) {
+    long sample = (long) (island_random_next(island) % (uint64_t) (j + 1));
+    for (long i = 0; i < n_sampled; i++) {
+      if (samples[i] == sample) {
+        sample = j;
+        break;
+      }
+    }
+    samples[n_sampled++] = sample;
+  }
+  for (long i = 0; i < n_sampled; i++) {
+    neighbors[i] = snapshot->neighbors[samples[i]];
+  }
+  send_data_to_neighbors(&send, neighbors, n_sampled);
+  island_leave_snapshot(island, slot);
+  free(neighbors);
+  free(samples);
+  end_data_send(&send);
+  return EXIT_SUCCESS;
+}
+
+long island_neighbor_ids(const Netislands_Island *island, unsigned *neighbor_ids, const long max_neighbor_ids) {
+  mtx_lock(island->neighbor_queue_mutex);
+  const Netislands_Neighbor_Index *index = island->neighbor_index;
+  for (long i = 0; i < index->length && i < max_neighbor_ids; i++) {
+    neighbor_ids[i] = index->neighbors[i]->id;
+  }
+  const long n_neighbors = index->length;
+  mtx_unlock(island->neighbor_queue_mutex);
+  return n_neighbors;
+}
+
 int island_send(const Netislands_Island *island, const char *message) {
+  DataHeader header;
+  init_data_header(&header, 0);
+  char payload[NETISLANDS_MAX_XDATA_HEADER_LENGTH];
+  const long message_length = strlen(message) + 1; // include the terminating \0
+  const Frame frame = island_data_frame(island, &header, payload, message, message_length);
+  island_journal_sent_message(island, NETISLANDS_VALUES_BYTES, message, message_length, 0.0);
+  return island_send_frame(island, &frame, 0);
+}
+
+int island_send_with_priority(const Netislands_Island *island, const char *message, const double priority) {
+  DataHeader header;
+  init_data_header(&header, NETISLANDS_XDATA_PRIORITY);
+  header.priority = priority;
+  char payload[NETISLANDS_MAX_XDATA_HEADER_LENGTH];
+  const long message_length = strlen(message) + 1; // include the terminating \0
+  const Frame frame = island_data_frame(island, &header, payload, message, message_length);
+  island_journal_sent_message(island, NETISLANDS_VALUES_BYTES, message, message_length, priority);
+  return island_send_frame(island, &frame, 0);
+}
+
+int island_send_values(const Netislands_Island *island, const Netislands_Value_Type type,
+                       const void *values, const long n_values) {
+  if (value_size(type) == 0 || n_values < 0) {
+    return EXIT_FAILURE;
+  }
+  DataHeader header;
+  init_data_header(&header, NETISLANDS_XDATA_VALUES);
+  header.value_type = type;
+  char payload[NETISLANDS_MAX_XDATA_HEADER_LENGTH];
+  const Frame frame = island_data_frame(island, &header, payload, values, n_values * value_size(type));
+  island_journal_sent_message(island, type, values, n_values, 0.0);
+  return island_send_frame(island, &frame, 0);
+}
+
+int island_send_f64(const Netislands_Island *island, const double *values, const long n_values) {
+  return island_send_values(island, NETISLANDS_VALUES_F64, values, n_values);
+}
+
+int island_send_i32(const Netislands_Island *island, const int32_t *values, const long n_values) {
+  return island_send_values(island, NETISLANDS_VALUES_I32, values, n_values);
+}
+
+static void reload_journaled_message(void *context, const int type, const double priority,
+                                     const char *data, const long length) {
+  Netislands_Island *island = (Netislands_Island *) context;
+  const long size = value_size((Netislands_Value_Type) type);
+  if (size == 0 || length % size != 0) { // corrupt record
+    return;
+  }
+  QueuedMessage *queued_message = (QueuedMessage *) malloc(sizeof(QueuedMessage));
+  queued_message->message.type = (Netislands_Value_Type) type;
+  queued_message->message.length = length / size;
+  queued_message->message.buffer = malloc(length > 0 ? length : 1);
+  memcpy(queued_message->message.buffer, data, length);
+  queued_message->message.values = queued_message->message.buffer;
+  queued_message->priority = priority;
+  queued_message->journal_offset = -1;
+  queued_message->sender_id = -1;
+  queued_message->enqueue_usecs = 0;
+  if (!island_insert_message(island, queued_message)) {
+    island_discard_message(island, queued_message);
+  }
+}
+
+int island_set_timing(Netislands_Island *island, const int enabled) {
+  island->timing = enabled;
+  return EXIT_SUCCESS;
+}
+
+int island_set_forwarding(Netislands_Island *island, const unsigned ttl) {
+  island->forward_ttl = ttl < NETISLANDS_MAX_FORWARD_TTL ? ttl : NETISLANDS_MAX_FORWARD_TTL;
+  return EXIT_SUCCESS;
+}
+
+static void send_ping_to_neighbor(void *element, void *args) {
+  connect_send_close((const Neighbor *) element, (const Frame *) args); // best effort
+}
+
+int island_ping(const Netislands_Island *island) {
+  // pings carry our own monotonic time, which the neighbor echoes back...
+  char ping[NETISLANDS_PING_LENGTH];
+  encode_uint32((uint32_t) island->port, ping);
+  encode_uint64((uint64_t) monotonic_usecs(), ping + 4);
+  const Frame frame = {NETISLANDS_PING_TAG, ping, NETISLANDS_PING_LENGTH, NULL, 0, island};
+  int slot;
+  const NeighborSnapshot *snapshot = island_enter_snapshot(island, &slot);
+  for (long i = 0; i < snapshot->length; i++) {
+    send_ping_to_neighbor(snapshot->neighbors[i], (void *) &frame);
+  }
+  island_leave_snapshot(island, slot);
+  return EXIT_SUCCESS;
+}
+
+// a piece of an emulated outgoing stream, delivered by the delivery thread of its link: its
+// connect (to target), a record, or its end record, after which the stream is closed and freed...
+typedef struct {
+  Netislands_Stream *stream;
+  Neighbor *target; // for the connect, NULL otherwise
+  int end;
+  long length;
+  char data[]; // record header and data
+} DelayedRecord;
+
+static void deliver_delayed_record(void *arg, const int cancelled) {
+  DelayedRecord *record = (DelayedRecord *) arg;
+  Netislands_Stream *stream = record->stream;
+  if (cancelled) { // the island is destroyed
+    __atomic_store_n(&stream->failed, 1, __ATOMIC_RELEASE);
+  } else if (!__atomic_load_n(&stream->failed, __ATOMIC_ACQUIRE)) {
+    int failed;
+    if (record->target != NULL) {
+      const Frame frame = {NETISLANDS_STREAM_TAG, NULL, 0, NULL, 0, stream->island};
+      stream->sockfd = connect_neighbor(record->target, stream->island);
+      failed = stream->sockfd == -1 || send_frame(stream->sockfd, &frame) == EXIT_FAILURE;
+    } else {
+      Segment segment;
+      set_segment(&segment, record->data, record->length);
+      failed = send_all_segments(stream->sockfd, &segment, 1, stream->island) == EXIT_FAILURE;
+    }
+    if (failed) {
+      __atomic_store_n(&stream->failed, 1, __ATOMIC_RELEASE);
+    }
+  }
+  if (record->end) {
+    if (stream->sockfd != -1) {
+      close(stream->sockfd);
+    }
+    free(stream);
+  } else {
+    Streams *streams = stream->island->streams;
+    mtx_lock(&streams->mutex);
+    stream->pending_bytes -= record->length;
+    cnd_broadcast(&streams->delivered);
+    mtx_unlock(&streams->mutex);
+  }
+  free(record->target);
+  free(record);
+}
+
+// delay a record of an emulated stream like a frame of its length. records are not lost or refused,
+// as TCP would retransmit them...
+static int schedule_record(Netislands_Stream *stream, DelayedRecord *record) {
+  long long delay_usecs;
+  emulation_apply(stream->island->port, stream->target_port, record->length, &delay_usecs);
+  return emulation_schedule(stream->island->port, stream->target_port, delay_usecs, 0, stream->island,
+                            &deliver_delayed_record, record);
+}
+
+static DelayedRecord *new_delayed_record(Netislands_Stream *stream, const void *data, const long length) {
+  DelayedRecord *record = (DelayedRecord *) malloc(sizeof(DelayedRecord) + NETISLANDS_STREAM_RECORD_HEADER_LENGTH + length);
+  record->stream = stream;
+  record->target = NULL;
+  record->end = length == 0;
+  record->length = NETISLANDS_STREAM_RECORD_HEADER_LENGTH + length;
+  encode_uint32((uint32_t) length, record->data);
+  if (length > 0) {
+    memcpy(record->data + NETISLANDS_STREAM_RECORD_HEADER_LENGTH, data, length);
+  }
+  return record;
+}
+
+// queue copies of the records of an emulated stream for the delivery thread of its link, waiting
+// while NETISLANDS_STREAM_WINDOW bytes are on their way...
+static int emulated_stream_write(Netislands_Stream *stream, const void *data, const long length) {
+  Streams *streams = stream->island->streams;
+  for (long position = 0; position < length && !__atomic_load_n(&stream->failed, __ATOMIC_ACQUIRE) && !stream->lost;
+       position += NETISLANDS_STREAM_CHUNK_LENGTH) {
+    const long record_length = length - position < NETISLANDS_STREAM_CHUNK_LENGTH
+      ? length - position : NETISLANDS_STREAM_CHUNK_LENGTH;
+    DelayedRecord *record = new_delayed_record(stream, (const char *) data + position, record_length);
+    mtx_lock(&streams->mutex);
+    while (stream->pending_bytes >= NETISLANDS_STREAM_WINDOW) {
+      cnd_wait(&streams->delivered, &streams->mutex);
+    }
+    stream->pending_bytes += record->length;
+    mtx_unlock(&streams->mutex);
+    if (schedule_record(stream, record) == EXIT_FAILURE) {
+      mtx_lock(&streams->mutex);
+      stream->pending_bytes -= record->length;
+      mtx_unlock(&streams->mutex);
+      free(record);
+      __atomic_store_n(&stream->failed, 1, __ATOMIC_RELEASE);
+    }
+  }
+  return __atomic_load_n(&stream->failed, __ATOMIC_ACQUIRE) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+Netislands_Stream *island_open_stream(const Netislands_Island *island, const unsigned neighbor_id) {
+  Neighbor target;
+  int slot;
+  const NeighborSnapshot *snapshot = island_enter_snapshot(island, &slot);
+  const long position = snapshot_position(snapshot, neighbor_id);
+  if (position != -1) {
+    copy_neighbor_address(&target, snapshot->neighbors[position]);
+  }
+  island_leave_snapshot(island, slot);
+  if (position == -1) { // unknown or removed neighbor
+    return NULL;
+  }
+  const Frame frame = {NETISLANDS_STREAM_TAG, NULL, 0, NULL, 0, island};
+  if (emulation_enabled() && emulation_matches(island->port, target.port)) {
+    // the connect and every record go through the delivery thread of the link, in order...
+    long long delay_usecs;
+    const EmulationVerdict verdict = emulate_link(&target, &frame, &delay_usecs);
+    if (verdict == EMULATION_REFUSE) {
+      return NULL;
+    }
+    Netislands_Stream *stream = (Netislands_Stream *) calloc(1, sizeof(Netislands_Stream));
+    stream->island = island;
+    stream->outgoing = 1;
+    stream->sockfd = -1;
+    stream->target_port = target.port;
+    stream->emulated = 1;
+    stream->lost = verdict == EMULATION_LOSE; // the writer does not notice
+    if (!stream->lost) {
+      DelayedRecord *record = (DelayedRecord *) calloc(1, sizeof(DelayedRecord));
+      record->stream = stream;
+      record->target = (Neighbor *) malloc(sizeof(Neighbor));
+      copy_neighbor_address(record->target, &target);
+      if (emulation_schedule(island->port, target.port, delay_usecs, 0, island, &deliver_delayed_record,
+                             record) == EXIT_FAILURE) {
+        free(record->target);
+        free(record);
+        free(stream);
+        return NULL;
+      }
+    }
+    return stream;
+  }
+  const int sockfd = connect_neighbor(&target, island);
+  if (sockfd == -1 || send_frame(sockfd, &frame) == EXIT_FAILURE) {
+    if (sockfd != -1) {
+      close(sockfd);
+    }
+    return NULL;
+  }
+  Netislands_Stream *stream = (Netislands_Stream *) calloc(1, sizeof(Netislands_Stream));
+  stream->island = island;
+  stream->outgoing = 1;
+  stream->sockfd = sockfd;
+  stream->target_port = target.port;
+  return stream;
+}
+
+// send data as records of at most NETISLANDS_STREAM_CHUNK_LENGTH bytes, without copying it...
+int island_stream_write(Netislands_Stream *stream, const void *data, const long length) {
+  if (!stream->outgoing || __atomic_load_n(&stream->failed, __ATOMIC_ACQUIRE) || length < 0) {
+    return EXIT_FAILURE;
+  }
+  if (stream->emulated) {
+    return emulated_stream_write(stream, data, length);
+  }
+  for (long position = 0; position < length && !stream->failed; position += NETISLANDS_STREAM_CHUNK_LENGTH) {
+    const long record_length = length - position < NETISLANDS_STREAM_CHUNK_LENGTH
+      ? length - position : NETISLANDS_STREAM_CHUNK_LENGTH;
+    char record_header[NETISLANDS_STREAM_RECORD_HEADER_LENGTH];
+    encode_uint32((uint32_t) record_length, record_header);
+    Segment segments[2];
+    set_segment(&segments[0], record_header, NETISLANDS_STREAM_RECORD_HEADER_LENGTH);
+    set_segment(&segments[1], (const char *) data + position, record_length);
+    stream->failed = send_all_segments(stream->sockfd, segments, 2, stream->island) == EXIT_FAILURE;
+  }
+  return stream->failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+Netislands_Stream *island_accept_stream(const Netislands_Island *island) {
+  mtx_lock(&island->streams->mutex);
+  Netislands_Stream *stream = island->streams->incoming;
+  while (stream != NULL && stream->accepted) {
+    stream = stream->next;
+  }
+  if (stream != NULL) {
+    stream->accepted = 1;
+  }
+  mtx_unlock(&island->streams->mutex);
+  return stream;
+}
+
+// read what has been received of a stream, up to length bytes, waiting for data if there is none
+// yet. returns 0 at the end of the stream and -1 if it was cut off...
+long island_stream_read(Netislands_Stream *stream, void *buffer, const long length) {
+  if (stream->outgoing) {
+    return -1;
+  }
+  Streams *streams = stream->island->streams;
+  long n_read = 0;
+  mtx_lock(&streams->mutex);
+  for (;;) {
+    while (stream->chunks != NULL && n_read < length) {
+      StreamChunk *chunk = stream->chunks;
+      const long n = chunk->length - stream->read_offset < length - n_read
+        ? chunk->length - stream->read_offset : length - n_read;
+      memcpy((char *) buffer + n_read, chunk->data + stream->read_offset, n);
+      n_read += n;
+      stream->read_offset += n;
+      stream->buffered_bytes -= n;
+      if (stream->read_offset == chunk->length) {
+        stream->chunks = chunk->next;
+        stream->read_offset = 0;
+        free(chunk->data);
+        free(chunk);
+      }
+    }
+    if (n_read > 0 || length <= 0 || !stream->connected) {
+      break;
+    }
+    cnd_wait(&streams->data_available, &streams->mutex);
+  }
+  if (n_read == 0 && length > 0 && !stream->end_received) {
+    n_read = -1;
+  }
+  // resume a paused connection once half the window is free, outside our lock, as the reactor calls
+  // stream_receive with the lock of its thread held...
+  const int resume = stream->paused && stream->buffered_bytes <= NETISLANDS_STREAM_WINDOW / 2;
+  if (resume) {
+    stream->paused = 0;
+  }
+  mtx_unlock(&streams->mutex);
+  if (resume) {
+    reactor_resume_stream(stream->island->reactor, stream);
+  }
+  return n_read;
+}
+
+int island_close_stream(Netislands_Stream *stream) {
+  if (stream->emulated) { // failures of the data still on its way are not reported
+    const int ret = __atomic_load_n(&stream->failed, __ATOMIC_ACQUIRE) ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (stream->lost) {
+      free(stream);
+      return ret;
+    }
+    // the delivery thread closes and frees the stream after its end record...
+    DelayedRecord *record = new_delayed_record(stream, NULL, 0);
+    if (schedule_record(stream, record) == EXIT_FAILURE) { // no delivery thread, nothing is on its way
+      if (stream->sockfd != -1) {
+        close(stream->sockfd);
+      }
+      free(record);
+      free(stream);
+      return EXIT_FAILURE;
+    }
+    return ret;
+  }
+  if (stream->outgoing) { // end it with an empty record
+    char end_record[NETISLANDS_STREAM_RECORD_HEADER_LENGTH];
+    encode_uint32(0, end_record);
+    Segment segment;
+    set_segment(&segment, end_record, NETISLANDS_STREAM_RECORD_HEADER_LENGTH);
+    const int ret = !stream->failed ? send_all_segments(stream->sockfd, &segment, 1, stream->island) : EXIT_FAILURE;
+    close(stream->sockfd);
+    free(stream);
+    return ret;
+  }
+  // an incoming stream is freed by the reactor if it still delivers data...
+  Streams *streams = stream->island->streams;
+  Reactor *reactor = stream->island->reactor;
+  mtx_lock(&streams->mutex);
+  const int connected = stream->connected;
+  const int paused = stream->paused;
+  if (connected) {
+    stream->closed = 1;
+    stream->paused = 0;
+  } else {
+    unlink_stream(streams, stream);
+  }
+  mtx_unlock(&streams->mutex);
+  if (!connected) {
+    free_stream(stream);
+  } else if (paused) { // let the reactor see that the stream is closed (and free it)
+    reactor_resume_stream(reactor, stream);
+  }
+  return EXIT_SUCCESS;
+}
+
+int island_request_messages(const Netislands_Island *island, const unsigned neighbor_id, const unsigned k) {
+  Neighbor target;
+  int slot;
+  const NeighborSnapshot *snapshot = island_enter_snapshot(island, &slot);
+  const long position = snapshot_position(snapshot, neighbor_id);
+  if (position != -1) {
+    copy_neighbor_address(&target, snapshot->neighbors[position]);
+  }
+  island_leave_snapshot(island, slot);
+  if (position == -1) { // unknown or removed neighbor
+    return EXIT_FAILURE;
+  }
+  char pull[NETISLANDS_PULL_LENGTH];
+  encode_uint32((uint32_t) island->port, pull);
+  encode_uint32((uint32_t) k, pull + 4);
+  const Frame frame = {NETISLANDS_PULL_TAG, pull, NETISLANDS_PULL_LENGTH, NULL, 0, island};
+  return connect_send_close(&target, &frame);
+}
+
+int island_offer_values(const Netislands_Island *island, const Netislands_Value_Type type,
+                        const void *values, const long n_values) {
+  if (value_size(type) == 0 || n_values < 0) {
+    return EXIT_FAILURE;
+  }
+  Netislands_Message *message = (Netislands_Message *) malloc(sizeof(Netislands_Message));
+  message->type = type;
+  message->length = n_values;
+  message->buffer = malloc(n_values > 0 ? n_values * value_size(type) : 1);
+  memcpy(message->buffer, values, n_values * value_size(type));
+  message->values = message->buffer;
+  Pull *pull = island->pull;
+  mtx_lock(&pull->mutex);
+  // if the outbox is full, drop the oldest offer...
+  Netislands_Message *message_to_drop;
+  if (pull->outbox_capacity != 0 && queue_length(&pull->outbox) >= pull->outbox_capacity
+      && queue_dequeue(&pull->outbox, (void **) &message_to_drop) != EXIT_FAILURE) {
+    pull->outbox_bytes -= message_bytes(message_to_drop);
+    island_free_message(message_to_drop);
+    free(message_to_drop);
+  }
+  queue_enqueue(&pull->outbox, message);
+  pull->outbox_bytes += message_bytes(message);
+  mtx_unlock(&pull->mutex);
+  return EXIT_SUCCESS;
+}
+
+int island_offer(const Netislands_Island *island, const char *message) {
+  return island_offer_values(island, NETISLANDS_VALUES_BYTES, message, strlen(message) + 1); // include the terminating \0
+}
+
+int island_set_provider(Netislands_Island *island, const Netislands_Provider provider, void *context) {
+  mtx_lock(&island->pull->mutex);
+  island->pull->provider = provider;
+  island->pull->provider_context = context;
+  mtx_unlock(&island->pull->mutex);
+  return EXIT_SUCCESS;
+}
+
+int island_stats(const Netislands_Island *island, Netislands_Island_Stats *stats) {
+  stats->messages_received = __atomic_load_n(&island->stats->messages_received, __ATOMIC_RELAXED);
+  stats->messages_dropped = __atomic_load_n(&island->stats->messages_dropped, __ATOMIC_RELAXED);
+  stats->messages_sent = __atomic_load_n(&island->stats->messages_sent, __ATOMIC_RELAXED);
+  stats->send_failures = __atomic_load_n(&island->stats->send_failures, __ATOMIC_RELAXED);
+  stats->sends_skipped = __atomic_load_n(&island->stats->sends_skipped, __ATOMIC_RELAXED);
+  stats->messages_relayed = __atomic_load_n(&island->stats->messages_relayed, __ATOMIC_RELAXED);
+  stats->duplicates_dropped = __atomic_load_n(&island->stats->duplicates_dropped, __ATOMIC_RELAXED);
+  stats->outbound_dropped = __atomic_load_n(&island->stats->outbound_dropped, __ATOMIC_RELAXED);
+  stats->messages_deduplicated = __atomic_load_n(&island->stats->messages_deduplicated, __ATOMIC_RELAXED);
+  stats->messages_rate_limited = __atomic_load_n(&island->stats->messages_rate_limited, __ATOMIC_RELAXED);
+  stats->messages_served = __atomic_load_n(&island->stats->messages_served, __ATOMIC_RELAXED);
+  return EXIT_SUCCESS;
+}
+
+long island_latency_stats(const Netislands_Island *island, Netislands_Neighbor_Latency *stats, const long max_stats) {
+  mtx_lock(island->neighbor_queue_mutex);
+  const Netislands_Neighbor_Index *index = island->neighbor_index;
+  for (long i = 0; i < index->length && i < max_stats; i++) {
+    stats[i] = index->neighbors[i]->latency;
+    stats[i].neighbor_id = index->neighbors[i]->id;
+  }
+  const long n_neighbors = index->length;
+  mtx_unlock(island->neighbor_queue_mutex);
+  return n_neighbors;
+}
+
+int island_memory_stats(const Netislands_Island *island, Netislands_Island_Memory *memory) {
+  mtx_lock(island->message_queue_mutex);
+  memory->message_queue_length = message_queue_length(island);
+  memory->message_queue_bytes = island->counters->message_queue_bytes;
+  mtx_unlock(island->message_queue_mutex);
+  // frames shared by several outbound queues are counted once per queue...
+  memory->outbound_frames = 0;
+  memory->outbound_bytes = 0;
   mtx_lock(island->neighbor_queue_mutex);
-  queue_for_each(island->neighbor_queue, &send_data_to_neighbor, (void *) message);
-  remove_failed_neighbors(island->neighbor_queue, island->max_failures);
+  const Netislands_Neighbor_Index *index = island->neighbor_index;
+  for (long i = 0; i < index->length; i++) {
+    const Neighbor *neighbor = index->neighbors[i];
+    for (long j = 0; j < neighbor->outbound_length; j++) {
+      const OutboundFrame *outbound_frame = neighbor->outbound_frames[(neighbor->outbound_head + j) % island->outbound->capacity];
+      memory->outbound_bytes += outbound_frame->payload_length + outbound_frame->values_length;
+    }
+    memory->outbound_frames += neighbor->outbound_length;
+  }
   mtx_unlock(island->neighbor_queue_mutex);
+  memory->stream_bytes = 0;
+  mtx_lock(&island->streams->mutex);
+  for (const Netislands_Stream *stream = island->streams->incoming; stream != NULL; stream = stream->next) {
+    for (const StreamChunk *chunk = stream->chunks; chunk != NULL; chunk = chunk->next) {
+      memory->stream_bytes += chunk->length;
+    }
+    if (stream->chunks != NULL) {
+      memory->stream_bytes -= stream->read_offset;
+    }
+  }
+  mtx_unlock(&island->streams->mutex);
+  mtx_lock(&island->pull->mutex);
+  memory->outbox_length = queue_length(&island->pull->outbox);
+  memory->outbox_bytes = island->pull->outbox_bytes;
+  mtx_unlock(&island->pull->mutex);
   return EXIT_SUCCESS;
 }
 
-char *island_dequeue_message(const Netislands_Island *island) {
+long island_outbound_stats(const Netislands_Island *island, Netislands_Neighbor_Outbound *stats, const long max_stats) {
+  mtx_lock(island->neighbor_queue_mutex);
+  const Netislands_Neighbor_Index *index = island->neighbor_index;
+  for (long i = 0; i < index->length && i < max_stats; i++) {
+    stats[i].neighbor_id = index->neighbors[i]->id;
+    stats[i].queue_length = index->neighbors[i]->outbound_length;
+    stats[i].max_queue_length = index->neighbors[i]->outbound_max_length;
+    stats[i].frames_dropped = index->neighbors[i]->outbound_dropped;
+  }
+  const long n_neighbors = index->length;
+  mtx_unlock(island->neighbor_queue_mutex);
+  return n_neighbors;
+}
+
+int island_open_journal(Netislands_Island *island, const char *path, const long capacity, const unsigned flags) {
+  Journal *journal = (Journal *) malloc(sizeof(Journal));
+  if (journal_open(journal, path, capacity) == EXIT_FAILURE) {
+    fprintf(stderr, "island_open_journal: error opening journal '%s'.\n", path);
+    free(journal);
+    return EXIT_FAILURE;
+  }
   mtx_lock(island->message_queue_mutex);
-  if (0 == queue_length(island->message_queue)) {
-    mtx_unlock(island->message_queue_mutex);
-    return NULL;
+  if (island->journal != NULL) { // replace a previously opened journal
+    journal_close(island->journal);
+    free(island->journal);
+    __atomic_store_n(&island->journal, NULL, __ATOMIC_RELAXED);
+  }
+  // reload the messages that were pending when the journal was closed (or its island died), then
+  // rewrite the journal with all queued messages...
+  journal_for_each_live(journal, &reload_journaled_message, island);
+  __atomic_store_n(&island->journal_flags, flags, __ATOMIC_RELAXED);
+  __atomic_store_n(&island->journal, journal, __ATOMIC_RELEASE);
+  island_compact_journal(island);
+  mtx_unlock(island->message_queue_mutex);
+  return EXIT_SUCCESS;
+}
+
+int island_close_journal(Netislands_Island *island) {
+  mtx_lock(island->message_queue_mutex);
+  if (island->journal != NULL) {
+    journal_close(island->journal);
+    free(island->journal);
+    __atomic_store_n(&island->journal, NULL, __ATOMIC_RELAXED);
+  }
+  mtx_unlock(island->message_queue_mutex);
+  return EXIT_SUCCESS;
+}
+
+int island_dequeue_values(const Netislands_Island *island, Netislands_Message *message) {
+  mtx_lock(island->message_queue_mutex);
+  QueuedMessage *recv_message;
+  int ret;
+  if (island->message_queue_mode == NETISLANDS_QUEUE_PRIORITY) {
+    ret = priority_queue_remove_max(island->message_priority_queue, NULL, (void **) &recv_message);
   } else {
-    char *recv_message;
-    queue_dequeue(island->message_queue, (void **) &recv_message);
-    mtx_unlock(island->message_queue_mutex);
-    return recv_message;
+    ret = queue_dequeue(island->message_queue, (void **) &recv_message);
+  }
+  if (ret != EXIT_FAILURE) {
+    island->counters->message_queue_bytes -= queued_message_bytes(recv_message);
+    if (island->journal != NULL && recv_message->journal_offset != -1) {
+      journal_consume(island->journal, recv_message->journal_offset);
+    }
+  }
+  mtx_unlock(island->message_queue_mutex);
+  if (ret == EXIT_FAILURE) {
+    return EXIT_FAILURE;
+  }
+  // account the queueing time of timed messages to their sending neighbor...
+  if (recv_message->sender_id != -1) {
+    const long long queueing_usecs = monotonic_usecs() - recv_message->enqueue_usecs;
+    mtx_lock(island->neighbor_queue_mutex);
+    const long position = neighbor_index_position(island->neighbor_index, (unsigned) recv_message->sender_id);
+    if (position != -1) {
+      latency_histogram_add(&island->neighbor_index->neighbors[position]->latency.queueing, queueing_usecs);
+    }
+    mtx_unlock(island->neighbor_queue_mutex);
+  }
+  *message = recv_message->message;
+  free(recv_message);
+  return EXIT_SUCCESS;
+}
+
+void island_free_message(Netislands_Message *message) {
+  free(message->buffer);
+  message->buffer = NULL;
+  message->values = NULL;
+  message->length = 0;
+}
+
+char *island_dequeue_message(const Netislands_Island *island) {
+  Netislands_Message message;
+  if (island_dequeue_values(island, &message) == EXIT_FAILURE) {
+    return NULL;
+  }
+  if (message.values == message.buffer) {
+    return (char *) message.buffer;
   }
+  // typed values inside a receive buffer are returned as a copy of their raw bytes...
+  const long length = message.length * value_size(message.type);
+  char *recv_message = (char *) malloc(length > 0 ? length : 1);
+  memcpy(recv_message, message.values, length);
+  island_free_message(&message);
+  return recv_message;
 }
 
 int island_destroy(Netislands_Island *island) {
-  // cleanup island server thread...
-  island->exit_flag = 1; // signal the server thread to exit
-  thrd_join(island->thread, NULL); // wait for the server thread to exit 
-  thrd_detach(island->thread);
+  // break off the connects and sends in progress, then stop joining, so that no join is retried
+  // after we are gone...
+  __atomic_store_n(&island->counters->stopping, 1, __ATOMIC_RELAXED);
+  signal_stop_fds(island->counters->stop_fds);
+  island_cancel_join(island);
+  // stop the senders, queued frames are dropped...
+  island_stop_sender(island);
+  // drop the frames and stream data still delayed by link emulation...
+  emulation_cancel(island);
+  // cleanup island server socket, no message handler runs after detaching from the reactor. an
+  // island that failed to start may have neither...
+  if (island->reactor != NULL) {
+    island_detach_reactor(island);
+  }
+  if (island->listenfd != -1 && close(island->listenfd) == -1) {
+#ifdef NETISLANDS_DEBUG
+    perror("island_destroy: close listenfd");
+#endif
+  }
+  // free the incoming streams, the reactor has cut off the ones still being received...
+  while (island->streams->incoming != NULL) {
+    Netislands_Stream *next = island->streams->incoming->next;
+    free_stream(island->streams->incoming);
+    island->streams->incoming = next;
+  }
+  mtx_destroy(&island->streams->mutex);
+  cnd_destroy(&island->streams->data_available);
+  cnd_destroy(&island->streams->delivered);
+  free(island->streams);
+  // drop the offers nobody pulled...
+  Netislands_Message *offer;
+  while (queue_dequeue(&island->pull->outbox, (void **) &offer) != EXIT_FAILURE) {
+    island_free_message(offer);
+    free(offer);
+  }
+  mtx_destroy(&island->pull->mutex);
+  free(island->pull);
+  // close the journal first, so that it keeps the pending messages for a restarted island...
+  island_close_journal(island);
   // cleanup island message queue... 
-  char *message;
-  while ((message = island_dequeue_message(island)) != NULL) {
-    free(message);
+  Netislands_Message message;
+  while (island_dequeue_values(island, &message) != EXIT_FAILURE) {
+    island_free_message(&message);
   }
   mtx_destroy(island->message_queue_mutex);
   free(island->message_queue_mutex);
   free(island->message_queue);
+  priority_queue_destroy(island->message_priority_queue);
+  free(island->message_priority_queue);
   // cleanup island neighbor queue... 
   Neighbor *neighbor;
   mtx_lock(island->neighbor_queue_mutex);
   while (queue_dequeue(island->neighbor_queue, (void **) &neighbor) != EXIT_FAILURE) {
-    free(neighbor);
+    free_neighbor(island, neighbor);
   }
+  free_retired_snapshots(island); // no sends are running anymore
+  free(island->snapshots->current);
+  free(island->snapshots);
   mtx_unlock(island->neighbor_queue_mutex);
   free(island->neighbor_queue_mutex);
   free(island->neighbor_queue);
-  // cleanup message buffer...
-  free(island->message_buffer);
+  free(island->neighbor_index->neighbors);
+  free(island->neighbor_index);
+  free(island->stats);
+  close_stop_fds(island->counters->stop_fds);
+  free(island->counters);
+  free(island->seen_ids);
+  free(island->dedup_hashes);
+  free_outbound(island->outbound);
   // maybe deinitialize network...
+  mtx_lock(&netislands_mutex);
   n_islands--;
   if (0 == n_islands) {
     netislands_shutdown();
   }
+  mtx_unlock(&netislands_mutex);
 #ifdef NETISLANDS_DEBUG
   fprintf(stderr, "Clean exit of island at port: %d\n", island->port);
 #endif
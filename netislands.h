@@ -7,34 +7,252 @@
 
 #include "tinycthread.h"
 #include "queue.h"
+#include "priority_queue.h"
+#include "topology.h"
+#include "emulation.h"
+#include <stdint.h>
 
 
 #define NETISLANDS_VERSION "1.0-0"
-#define NETISLANDS_PROTOCOL_VERSION "1.0-0"
+#define NETISLANDS_PROTOCOL_VERSION "1.1-0"
 #define NETISLANDS_PROTOCOL_VERSION_LENGTH 5
 #define NETISLANDS_PROTOCOL_ID "netislands"
 #define NETISLANDS_PROTOCOL_ID_LENGTH 10
 
 #define NETISLANDS_SERVER_BUFFER_LENGTH 16384 // 16 kiB 
 #define NETISLANDS_BACKLOG 1024 
+#define NETISLANDS_POLL_TIMEOUT_MSECS 500
 #define NETISLANDS_MAX_HOSTNAME_LENGTH 1024
 #define NETISLANDS_MAX_PORT_STRING_LENGTH 8
+#define NETISLANDS_MAX_FILL_STRING_LENGTH 32
+#define NETISLANDS_JOIN_PARALLELISM 8 // neighbors contacted at the same time when joining
+#define NETISLANDS_JOIN_RETRY_MSECS 100 // first retry delay of a failed join, doubled for every further retry
+#define NETISLANDS_CONNECT_TIMEOUT_MSECS 5000 // connects to a neighbor fail after this time
+#define NETISLANDS_SEND_TIMEOUT_MSECS 5000 // sends fail if the neighbor takes no data for this time
 
+// receiver-driven backpressure, fill levels are given in per mille of max_message_queue_length...
+#define NETISLANDS_BACKPRESSURE_LOW_WATERMARK 500 // senders throttle above this fill level
+#define NETISLANDS_BACKPRESSURE_HIGH_WATERMARK 900 // senders skip neighbors above this fill level
+#define NETISLANDS_BACKPRESSURE_STEP 100 // fill level change that triggers an advertisement
+#define NETISLANDS_BACKPRESSURE_HEARTBEAT_MSECS 1000 // re-advertisement interval while loaded
+
+// traffic capture files start with the magic, followed by one record per received frame: receive
+// time in microseconds since the start of the capture (8 bytes), receiving port (4 bytes), frame
+// length (4 bytes) and the frame, all numbers big-endian...
+#define NETISLANDS_CAPTURE_MAGIC "NICAPT01"
+#define NETISLANDS_CAPTURE_RECORD_HEADER_LENGTH 16
+#define NETISLANDS_CAPTURE_BUFFER_LENGTH 65536
+
+#define NETISLANDS_LATENCY_BUCKETS 32
+
+#define NETISLANDS_MAX_FORWARD_TTL 255
+#define NETISLANDS_SEEN_SET_LENGTH 4096 // recently forwarded messages remembered per island
+#define NETISLANDS_SNAPSHOT_READERS 64 // threads reading an island's neighbor snapshot at the same time
+#define NETISLANDS_STREAM_CHUNK_LENGTH 1048576 // longest record of a stream, longer writes are split
+#define NETISLANDS_STREAM_WINDOW 4194304 // received stream data buffered per stream before its connection is paused
+#define NETISLANDS_OUTBOX_LENGTH 1024 // default number of offered messages kept for pull requests
+#define NETISLANDS_MAX_PULL_MESSAGES 256 // messages sent in reply to one pull request at most
+#define NETISLANDS_BACKGROUND_QUEUE_LENGTH 1024 // frames queued per neighbor for relays and replies if data messages are not queued
+
+// message journal flags...
+#define NETISLANDS_JOURNAL_SENT 0x01 // journal sent messages too, for the record
+
+
+typedef enum {
+  NETISLANDS_QUEUE_FIFO,    // dequeue oldest message first, drop oldest message when full
+  NETISLANDS_QUEUE_PRIORITY // dequeue highest priority message first, drop lowest priority message when full
+} Netislands_Queue_Mode;
+
+// what to do with a frame for a neighbor whose outbound queue is full...
+typedef enum {
+  NETISLANDS_OUTBOUND_DROP_OLDEST, // drop the oldest queued frame to make room
+  NETISLANDS_OUTBOUND_DROP_NEWEST, // drop the new frame
+  NETISLANDS_OUTBOUND_BLOCK        // wait for room, drop the new frame after a timeout
+} Netislands_Outbound_Policy;
+
+// value types of typed messages, values are sent in the byte order of the sender and converted
+// by the receiver if necessary...
+typedef enum {
+  NETISLANDS_VALUES_BYTES, // untyped message, e.g. a string sent by island_send
+  NETISLANDS_VALUES_F64,   // double
+  NETISLANDS_VALUES_F32,   // float
+  NETISLANDS_VALUES_I32,   // int32_t
+  NETISLANDS_VALUES_I64    // int64_t
+} Netislands_Value_Type;
+
+// a received message, values point into the receive buffer and are aligned for their type...
+typedef struct {
+  Netislands_Value_Type type;
+  long length; // number of values (number of bytes for untyped messages)
+  void *values;
+  void *buffer; // allocation holding the values, released by island_free_message
+} Netislands_Message;
+
+// latency histogram with logarithmic buckets, bucket i counts latencies of [2^i, 2^(i+1))
+// microseconds, bucket 0 also counts latencies below one microsecond...
+typedef struct {
+  unsigned long counts[NETISLANDS_LATENCY_BUCKETS];
+  unsigned long n;
+  long long sum_usecs;
+  long long min_usecs;
+  long long max_usecs;
+} Netislands_Latency_Histogram;
+
+typedef struct {
+  unsigned neighbor_id;
+  Netislands_Latency_Histogram network;    // send to receive time, needs synchronized clocks
+  Netislands_Latency_Histogram queueing;   // receive to dequeue time
+  Netislands_Latency_Histogram round_trip; // ping round trip time, independent of clocks
+} Netislands_Neighbor_Latency;
+
+// message counters of an island...
+typedef struct {
+  unsigned long messages_received; // messages stored in the message queue
+  unsigned long messages_dropped;  // messages dropped because the message queue was full
+  unsigned long messages_sent;     // messages sent, counted once per neighbor
+  unsigned long send_failures;
+  unsigned long sends_skipped;     // sends skipped because of neighbor backpressure
+  unsigned long messages_relayed;  // forwarded messages passed on to the neighbors
+  unsigned long duplicates_dropped; // forwarded messages received more than once
+  unsigned long outbound_dropped;  // frames dropped because an outbound queue was full
+  unsigned long messages_deduplicated; // received messages dropped as recent duplicates of their contents
+  unsigned long messages_rate_limited; // connections rejected by the inbound message rate of their sender
+  unsigned long messages_served;   // messages sent in reply to pull requests of neighbors
+} Netislands_Island_Stats;
+
+// outbound queue of a neighbor...
+typedef struct {
+  unsigned neighbor_id;
+  long queue_length;
+  long max_queue_length; // highest queue length so far
+  unsigned long frames_dropped;
+} Netislands_Neighbor_Outbound;
+
+// memory held by an island, in bytes of message contents (without bookkeeping)...
+typedef struct {
+  long message_queue_length;
+  long message_queue_bytes; // values of the queued messages
+  long outbound_frames;     // frames in the outbound queues of all neighbors
+  long outbound_bytes;
+  long stream_bytes;        // received stream data not read yet
+  long outbox_length;       // offered messages not pulled yet
+  long outbox_bytes;
+} Netislands_Island_Memory;
+
+// socket options, 0 keeps the system default...
+typedef struct {
+  int send_buffer_length;    // SO_SNDBUF of sending sockets
+  int receive_buffer_length; // SO_RCVBUF of the server socket and its connections
+  int tcp_nodelay;           // disable Nagle's algorithm on sending sockets
+  int tcp_quickack;          // acknowledge received data immediately (Linux only)
+} Netislands_Socket_Options;
+
+// island settings, island_config_init sets the defaults of island_init...
+typedef struct {
+  int port;
+  long max_message_queue_length;
+  long max_message_queue_bytes; // budget for the values of the queued messages, 0 for unlimited
+  unsigned max_failures;
+  Netislands_Queue_Mode message_queue_mode;
+  int timing;
+  unsigned forward_ttl;     // see island_set_forwarding
+  long dedup_length;        // recently received message contents remembered to drop duplicates, 0 disables
+  const char *journal_path; // NULL for no journal
+  long journal_capacity;
+  unsigned journal_flags;
+  Netislands_Socket_Options socket_options;
+  int backlog;
+  long max_message_length;  // receive buffer ceiling, longer messages are dropped
+  double inbound_messages_per_sec; // messages accepted per sending island and second, 0 for unlimited
+  double inbound_bytes_per_sec;    // bytes received per sending island and second (reading pauses beyond), 0 for unlimited
+  int poll_timeout_msecs;   // reactor poll interval, applies to the shared reactor if this island starts it
+  long outbound_queue_length; // frames queued per neighbor and sent by a sender thread, 0 sends synchronously
+  Netislands_Outbound_Policy outbound_policy;
+  int outbound_block_msecs; // timeout of NETISLANDS_OUTBOUND_BLOCK
+  unsigned sender_threads;  // sender threads sharing the outbound queues, 0 for one per core
+  unsigned join_parallelism; // neighbors contacted at the same time when joining
+  unsigned join_retries;    // retries of failed joins, with jittered exponential backoff
+  int join_retry_msecs;     // delay before the first retry
+  int join_async;           // return from island_init_with_config while joins are still sent
+  long outbox_length;       // offered messages kept for pull requests (the oldest is dropped), 0 for unlimited
+  int reactor_threads;      // 0 follows netislands_enable_shared_reactor, n > 0 uses the shared reactor
+                            // (started with n threads if not running), -1 a reactor thread of its own
+} Netislands_Config;
+
+// fills in up to max_messages messages to answer a pull request of a neighbor and returns their
+// number. the messages are sent right after the provider returns, then their buffers are freed with
+// island_free_message (set buffer to NULL to keep ownership of the values)...
+typedef long (*Netislands_Provider)(void *context, Netislands_Message *messages, const long max_messages);
+
+// random access index of the neighbor queue, neighbors are ordered by their (stable) neighbor id...
+typedef struct {
+  struct Netislands_Neighbor **neighbors;
+  long length;
+  long capacity;
+  unsigned next_id;
+  unsigned long long random_state;
+} Netislands_Neighbor_Index;
+
+struct Reactor;
+struct Journal;
+struct Netislands_Outbound;
+struct Netislands_Neighbor_Snapshots;
+struct Netislands_Join;
+struct Netislands_Streams;
+struct Netislands_Pull;
+struct Netislands_Counters;
+
+// a stream of data sent to or received from a neighbor, see island_open_stream...
+typedef struct Netislands_Stream Netislands_Stream;
 
 typedef struct {
   int port; 
+  int listenfd;
+  struct Reactor *reactor;
   Queue *neighbor_queue;
+  Netislands_Neighbor_Index *neighbor_index;
   mtx_t *neighbor_queue_mutex; 
   long max_message_queue_length;
+  long max_message_queue_bytes;
   unsigned max_failures;
   Queue *message_queue;
+  PriorityQueue *message_priority_queue;
+  Netislands_Queue_Mode message_queue_mode;
   mtx_t *message_queue_mutex; 
-  thrd_t thread;
-  int exit_flag;
-  char *message_buffer;
+  struct Journal *journal;
+  unsigned journal_flags;
+  int advertised_fill_level;
+  long long advertised_fill_level_time;
+  int timing; // send timestamps and sequence numbers with data messages
+  struct Netislands_Counters *counters; // counters updated through const islands
+  Netislands_Island_Stats *stats;
+  Netislands_Socket_Options socket_options;
+  unsigned forward_ttl; // hops data messages travel, 0 for direct neighbors only
+  unsigned long long origin_id; // random id of this island in forwarded messages
+  unsigned long long *seen_ids; // seen set of forwarded messages
+  unsigned long long *dedup_hashes; // content hashes of recently received messages, NULL without dedup
+  long dedup_length;
+  struct Netislands_Outbound *outbound; // outbound queues and sender threads
+  struct Netislands_Neighbor_Snapshots *snapshots; // neighbor set read by senders without the neighbor_queue lock
+  struct Netislands_Join *join; // join announcements sent in the background, NULL if sent by island_init
+  struct Netislands_Streams *streams; // incoming streams
+  struct Netislands_Pull *pull; // messages offered to neighbors pulling them
 } Netislands_Island;
 
 
+int netislands_enable_shared_reactor(const unsigned n_threads);
+
+int netislands_disable_shared_reactor(void);
+
+int netislands_start_capture(const char *path);
+
+int netislands_stop_capture(void);
+
+int netislands_set_link_emulation(const unsigned n_links, const LinkEmulation links[n_links],
+                                  const unsigned long seed);
+
+int netislands_load_link_emulation(const char *path, const unsigned long seed);
+
 int island_init(Netislands_Island *island,
                 const int port,
                 const unsigned n_neighbors,
@@ -43,10 +261,88 @@ int island_init(Netislands_Island *island,
                 const long max_message_queue_length,
                 const unsigned max_failures); 
 
+void island_config_init(Netislands_Config *config,
+                        const int port,
+                        const long max_message_queue_length,
+                        const unsigned max_failures);
+
+int island_init_with_config(Netislands_Island *island,
+                            const Netislands_Config *config,
+                            const unsigned n_neighbors,
+                            const char *neighbor_hostnames[n_neighbors],
+                            const int neighbor_ports[n_neighbors]);
+
+int island_init_with_topology(Netislands_Island *island,
+                              const unsigned n_hosts,
+                              const char *hostnames[n_hosts],
+                              const int ports[n_hosts],
+                              const unsigned host_index,
+                              const Topology *topology,
+                              const long max_message_queue_length,
+                              const unsigned max_failures);
+
+int island_set_message_queue_mode(Netislands_Island *island, const Netislands_Queue_Mode mode);
+
 int island_send(const Netislands_Island *island, const char *message);
 
+int island_send_with_priority(const Netislands_Island *island, const char *message, const double priority);
+
+int island_send_to(const Netislands_Island *island, const unsigned *neighbor_ids, const unsigned n, const char *message);
+
+int island_send_random_k(const Netislands_Island *island, const unsigned k, const char *message);
+
+int island_send_values(const Netislands_Island *island, const Netislands_Value_Type type,
+                       const void *values, const long n_values);
+
+int island_send_f64(const Netislands_Island *island, const double *values, const long n_values);
+
+int island_send_i32(const Netislands_Island *island, const int32_t *values, const long n_values);
+
+long island_neighbor_ids(const Netislands_Island *island, unsigned *neighbor_ids, const long max_neighbor_ids);
+
+int island_open_journal(Netislands_Island *island, const char *path, const long capacity, const unsigned flags);
+
+int island_close_journal(Netislands_Island *island);
+
+int island_set_timing(Netislands_Island *island, const int enabled);
+
+int island_set_forwarding(Netislands_Island *island, const unsigned ttl);
+
+int island_ping(const Netislands_Island *island);
+
+Netislands_Stream *island_open_stream(const Netislands_Island *island, const unsigned neighbor_id);
+
+int island_stream_write(Netislands_Stream *stream, const void *data, const long length);
+
+Netislands_Stream *island_accept_stream(const Netislands_Island *island);
+
+long island_stream_read(Netislands_Stream *stream, void *buffer, const long length);
+
+int island_close_stream(Netislands_Stream *stream);
+
+int island_request_messages(const Netislands_Island *island, const unsigned neighbor_id, const unsigned k);
+
+int island_offer(const Netislands_Island *island, const char *message);
+
+int island_offer_values(const Netislands_Island *island, const Netislands_Value_Type type,
+                        const void *values, const long n_values);
+
+int island_set_provider(Netislands_Island *island, const Netislands_Provider provider, void *context);
+
+int island_stats(const Netislands_Island *island, Netislands_Island_Stats *stats);
+
+long island_latency_stats(const Netislands_Island *island, Netislands_Neighbor_Latency *stats, const long max_stats);
+
+int island_memory_stats(const Netislands_Island *island, Netislands_Island_Memory *memory);
+
+long island_outbound_stats(const Netislands_Island *island, Netislands_Neighbor_Outbound *stats, const long max_stats);
+
 char *island_dequeue_message(const Netislands_Island *island);
 
+int island_dequeue_values(const Netislands_Island *island, Netislands_Message *message);
+
+void island_free_message(Netislands_Message *message);
+
 int island_destroy(Netislands_Island *island);
 
 #endif
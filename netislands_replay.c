@@ -0,0 +1,216 @@
+/* netislands_replay.c
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#include "netislands.h"
+
+#ifdef _WIN32
+  #define _WIN32_WINNT 0x501
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+  #include <windows.h>
+  #define close(a) closesocket(a)
+#else
+  #include <unistd.h>
+  #include <netdb.h>
+  #include <sys/types.h>
+  #include <sys/socket.h>
+  #include <netinet/in.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_TAG_OFFSET (NETISLANDS_PROTOCOL_ID_LENGTH + NETISLANDS_PROTOCOL_VERSION_LENGTH)
+#define REPLAY_MAX_SLEEP_USECS 500000
+#define REPLAY_MAX_FRAME_LENGTH 67108864 // 64 MiB, longer records are taken as a corrupt capture
+
+
+static long long replay_monotonic_usecs() {
+#ifdef _WIN32
+  return (long long) GetTickCount() * 1000;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+static void replay_sleep_usecs(long long usecs) {
+  while (usecs > 0) {
+    const long long step = usecs < REPLAY_MAX_SLEEP_USECS ? usecs : REPLAY_MAX_SLEEP_USECS;
+#ifdef _WIN32
+    Sleep((DWORD) (step / 1000));
+#else
+    usleep((useconds_t) step);
+#endif
+    usecs -= step;
+  }
+}
+
+static unsigned long long decode_number(const unsigned char *buf, const int length) {
+  unsigned long long value = 0;
+  for (int i = 0; i < length; i++) {
+    value = (value << 8) | buf[i];
+  }
+  return value;
+}
+
+static int is_data_frame(const char *frame, const long frame_length) {
+  return frame_length >= REPLAY_TAG_OFFSET + 8
+    && (memcmp(frame + REPLAY_TAG_OFFSET, "data---", 8) == 0 || memcmp(frame + REPLAY_TAG_OFFSET, "xdata--", 8) == 0);
+}
+
+static int send_frame(const struct sockaddr_storage *address, const socklen_t address_length, const int port,
+                      const char *frame, const long frame_length) {
+  struct sockaddr_storage target = *address;
+  if (target.ss_family == AF_INET6) {
+    ((struct sockaddr_in6 *) &target)->sin6_port = htons(port);
+  } else {
+    ((struct sockaddr_in *) &target)->sin_port = htons(port);
+  }
+  const int sockfd = socket(target.ss_family, SOCK_STREAM, IPPROTO_TCP);
+  if (sockfd == -1) {
+    return EXIT_FAILURE;
+  }
+  if (connect(sockfd, (const struct sockaddr *) &target, address_length) == -1) {
+    close(sockfd);
+    return EXIT_FAILURE;
+  }
+  for (long sent = 0; sent < frame_length; ) {
+    const long bytes_sent = (long) send(sockfd, frame + sent, frame_length - sent, 0);
+    if (bytes_sent <= 0) {
+      close(sockfd);
+      return EXIT_FAILURE;
+    }
+    sent += bytes_sent;
+  }
+  close(sockfd);
+  return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[]) {
+  double speed = 1.0; // 0 replays at maximum speed
+  int all_frames = 0;
+  const char *hostname = "localhost";
+  int port_offset = 0;
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      speed = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-m") == 0) {
+      speed = 0.0;
+    } else if (strcmp(argv[i], "-a") == 0) {
+      all_frames = 1;
+    } else if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) {
+      hostname = argv[++i];
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      port_offset = atoi(argv[++i]);
+    } else if (NULL == path && argv[i][0] != '-') {
+      path = argv[i];
+    } else {
+      path = NULL;
+      break;
+    }
+  }
+  if (NULL == path || speed < 0.0) {
+    printf("usage: %s [-s speed_factor | -m] [-a] [-h hostname] [-o port_offset] capture_file\n", argv[0]);
+    printf("  -s  replay at speed_factor times the original speed (default 1)\n");
+    printf("  -m  replay at maximum speed\n");
+    printf("  -a  replay all frames, not only data frames\n");
+    printf("  -h  send to the islands on hostname (default localhost)\n");
+    printf("  -o  add port_offset to the captured receiving ports\n");
+    return EXIT_FAILURE;
+  }
+#ifdef _WIN32
+  WSADATA ws_data;
+  WSAStartup(MAKEWORD(2, 2), &ws_data);
+#endif
+  FILE *capture = fopen(path, "rb");
+  char magic[sizeof(NETISLANDS_CAPTURE_MAGIC)];
+  if (NULL == capture || fread(magic, 1, strlen(NETISLANDS_CAPTURE_MAGIC), capture) != strlen(NETISLANDS_CAPTURE_MAGIC)
+      || memcmp(magic, NETISLANDS_CAPTURE_MAGIC, strlen(NETISLANDS_CAPTURE_MAGIC)) != 0) {
+    printf("%s: cannot read capture file '%s'.\n", argv[0], path);
+    return EXIT_FAILURE;
+  }
+  // resolve the target host once, the port is set per frame...
+  struct addrinfo hints, *results;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(hostname, NULL, &hints, &results) != 0) {
+    printf("%s: cannot resolve hostname '%s'.\n", argv[0], hostname);
+    return EXIT_FAILURE;
+  }
+  struct sockaddr_storage address;
+  if (results->ai_addrlen > sizeof(address)) {
+    printf("%s: unsupported address for hostname '%s'.\n", argv[0], hostname);
+    freeaddrinfo(results);
+    return EXIT_FAILURE;
+  }
+  memcpy(&address, results->ai_addr, results->ai_addrlen);
+  const socklen_t address_length = results->ai_addrlen;
+  freeaddrinfo(results);
+
+  // replay frames on the captured schedule, scaled by speed...
+  unsigned char record_header[NETISLANDS_CAPTURE_RECORD_HEADER_LENGTH];
+  char *frame = NULL;
+  long frame_capacity = 0;
+  long n_sent = 0, n_failed = 0, n_skipped = 0;
+  int aborted = 0;
+  long long n_bytes = 0, max_lag_usecs = 0;
+  const long long start = replay_monotonic_usecs();
+  while (fread(record_header, 1, NETISLANDS_CAPTURE_RECORD_HEADER_LENGTH, capture) == NETISLANDS_CAPTURE_RECORD_HEADER_LENGTH) {
+    const long long timestamp = (long long) decode_number(record_header, 8);
+    const int port = (int) decode_number(record_header + 8, 4);
+    const long frame_length = (long) decode_number(record_header + 12, 4);
+    if (frame_length > REPLAY_MAX_FRAME_LENGTH) {
+      printf("%s: corrupt capture file (frame of %ld bytes), stopping.\n", argv[0], frame_length);
+      aborted = 1;
+      break;
+    }
+    if (frame_length > frame_capacity) {
+      char *new_frame = (char *) realloc(frame, frame_length);
+      if (NULL == new_frame) {
+        printf("%s: cannot allocate a frame of %ld bytes, stopping.\n", argv[0], frame_length);
+        aborted = 1;
+        break;
+      }
+      frame = new_frame;
+      frame_capacity = frame_length;
+    }
+    if (fread(frame, 1, frame_length, capture) != (size_t) frame_length) {
+      printf("%s: truncated capture file, stopping.\n", argv[0]);
+      break;
+    }
+    if (!all_frames && !is_data_frame(frame, frame_length)) {
+      n_skipped++;
+      continue;
+    }
+    if (speed > 0.0) {
+      const long long lag = replay_monotonic_usecs() - start - (long long) (timestamp / speed);
+      if (lag < 0) {
+        replay_sleep_usecs(-lag);
+      } else if (lag > max_lag_usecs) {
+        max_lag_usecs = lag;
+      }
+    }
+    if (send_frame(&address, address_length, port + port_offset, frame, frame_length) == EXIT_SUCCESS) {
+      n_sent++;
+      n_bytes += frame_length;
+    } else {
+      n_failed++;
+    }
+  }
+  const double elapsed_secs = (replay_monotonic_usecs() - start) / 1e6;
+  free(frame);
+  fclose(capture);
+  printf("Replayed %ld frames (%lld bytes) in %.3f s: %.1f frames/s, %.3f MB/s.\n", n_sent, n_bytes, elapsed_secs,
+         elapsed_secs > 0 ? n_sent / elapsed_secs : 0.0, elapsed_secs > 0 ? n_bytes / elapsed_secs / 1e6 : 0.0);
+  printf("Failed sends: %ld, skipped control frames: %ld, maximum lag behind schedule: %.3f ms.\n",
+         n_failed, n_skipped, max_lag_usecs / 1e3);
+#ifdef _WIN32
+  WSACleanup();
+#endif
+  return n_failed > 0 || aborted ? EXIT_FAILURE : EXIT_SUCCESS;
+}
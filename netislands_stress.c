@@ -0,0 +1,369 @@
+/* netislands_stress.c
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#include "netislands.h"
+
+#ifndef _WIN32
+  #include <unistd.h>
+  #include <dirent.h>
+  #include <sys/resource.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRESS_TICK_USECS 10000
+#define STRESS_REPORT_USECS 1000000
+
+
+typedef struct {
+  unsigned n_islands;
+  int base_port;
+  Topology topology;
+  double rate; // messages per second and island
+  long message_size;
+  long max_message_queue_length;
+  double duration_secs;
+  int reactor_threads; // -1 for a private reactor per island
+  unsigned n_workers;
+  unsigned forward_ttl;
+  const char *emulation_path; // link emulation file, NULL for unimpaired links
+  unsigned long emulation_seed;
+} StressConfig;
+
+// a driver thread sends from and drains the islands assigned to it...
+typedef struct {
+  const StressConfig *config;
+  Netislands_Island *islands;
+  unsigned first_island;
+  unsigned island_step;
+  volatile int exit_flag;
+  thrd_t thread;
+  unsigned long n_sends;
+  unsigned long n_dequeued;
+  long long send_usecs;
+  long long max_send_usecs;
+} StressWorker;
+
+
+static long long stress_monotonic_usecs() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static long count_threads() {
+#ifdef __linux__
+  FILE *status = fopen("/proc/self/status", "r");
+  char line[256];
+  long n_threads = -1;
+  while (status != NULL && fgets(line, sizeof(line), status) != NULL) {
+    if (strncmp(line, "Threads:", 8) == 0) {
+      n_threads = atol(line + 8);
+      break;
+    }
+  }
+  if (status != NULL) {
+    fclose(status);
+  }
+  return n_threads;
+#else
+  return -1;
+#endif
+}
+
+static long count_fds() {
+#ifdef __linux__
+  DIR *fds = opendir("/proc/self/fd");
+  long n_fds = 0;
+  if (NULL == fds) {
+    return -1;
+  }
+  while (readdir(fds) != NULL) {
+    n_fds++;
+  }
+  closedir(fds);
+  return n_fds - 3; // ".", ".." and the directory itself
+#else
+  return -1;
+#endif
+}
+
+static int stress_worker_main(void *args) {
+  StressWorker *worker = (StressWorker *) args;
+  const StressConfig *config = worker->config;
+  char *message = (char *) malloc(config->message_size);
+  memset(message, 'm', config->message_size - 1);
+  message[config->message_size - 1] = '\0';
+  double credit = 0.0;
+  long long last = stress_monotonic_usecs();
+  while (!worker->exit_flag) {
+    usleep(STRESS_TICK_USECS);
+    const long long now = stress_monotonic_usecs();
+    credit += config->rate * (now - last) / 1e6;
+    last = now;
+    // send the messages due in this tick from each island of this worker...
+    for (; credit >= 1.0; credit -= 1.0) {
+      for (unsigned i = worker->first_island; i < config->n_islands; i += worker->island_step) {
+        const long long start = stress_monotonic_usecs();
+        island_send(&worker->islands[i], message);
+        const long long send_usecs = stress_monotonic_usecs() - start;
+        worker->send_usecs += send_usecs;
+        if (send_usecs > worker->max_send_usecs) {
+          worker->max_send_usecs = send_usecs;
+        }
+        worker->n_sends++;
+      }
+    }
+    // ...and drain their message queues, like an evolutionary algorithm would do between generations...
+    for (unsigned i = worker->first_island; i < config->n_islands; i += worker->island_step) {
+      char *recv_message;
+      while ((recv_message = island_dequeue_message(&worker->islands[i])) != NULL) {
+        free(recv_message);
+        worker->n_dequeued++;
+      }
+    }
+  }
+  free(message);
+  return EXIT_SUCCESS;
+}
+
+static void histogram_merge(Netislands_Latency_Histogram *total, const Netislands_Latency_Histogram *histogram) {
+  if (histogram->n == 0) {
+    return;
+  }
+  for (int i = 0; i < NETISLANDS_LATENCY_BUCKETS; i++) {
+    total->counts[i] += histogram->counts[i];
+  }
+  if (total->n == 0 || histogram->min_usecs < total->min_usecs) {
+    total->min_usecs = histogram->min_usecs;
+  }
+  if (total->n == 0 || histogram->max_usecs > total->max_usecs) {
+    total->max_usecs = histogram->max_usecs;
+  }
+  total->n += histogram->n;
+  total->sum_usecs += histogram->sum_usecs;
+}
+
+// upper bound of the bucket holding the given quantile...
+static long long histogram_quantile(const Netislands_Latency_Histogram *histogram, const double quantile) {
+  unsigned long seen = 0;
+  for (int i = 0; i < NETISLANDS_LATENCY_BUCKETS; i++) {
+    seen += histogram->counts[i];
+    if (seen > 0 && seen >= quantile * histogram->n) {
+      return 1LL << (i + 1);
+    }
+  }
+  return histogram->max_usecs;
+}
+
+static void print_histogram(const char *name, const Netislands_Latency_Histogram *histogram) {
+  if (histogram->n == 0) {
+    printf("%-22s no samples\n", name);
+    return;
+  }
+  printf("%-22s mean %.3f ms, p50 < %.3f ms, p99 < %.3f ms, max %.3f ms (%lu samples)\n", name,
+         histogram->sum_usecs / 1e3 / histogram->n, histogram_quantile(histogram, 0.5) / 1e3,
+         histogram_quantile(histogram, 0.99) / 1e3, histogram->max_usecs / 1e3, histogram->n);
+}
+
+static int parse_topology(const char *name, TopologyKind *kind) {
+  const char *names[5] = {"ring", "torus", "hypercube", "random", "smallworld"};
+  const TopologyKind kinds[5] = {
+    TOPOLOGY_RING, TOPOLOGY_TORUS_2D, TOPOLOGY_HYPERCUBE, TOPOLOGY_RANDOM_REGULAR, TOPOLOGY_SMALL_WORLD
+  };
+  for (int i = 0; i < 5; i++) {
+    if (strcmp(name, names[i]) == 0) {
+      *kind = kinds[i];
+      return EXIT_SUCCESS;
+    }
+  }
+  return EXIT_FAILURE;
+}
+
+int main(int argc, char* argv[]) {
+  StressConfig config = {
+    200, 30000, {TOPOLOGY_RANDOM_REGULAR, 4, 0, 0.1, 42}, 10.0, 256, 64, 10.0, 0, 4, 0, NULL, 1
+  };
+  int usage = 0;
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 >= argc) {
+      usage = 1;
+    } else if (strcmp(argv[i], "-n") == 0) {
+      config.n_islands = (unsigned) atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-p") == 0) {
+      config.base_port = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-t") == 0) {
+      usage |= parse_topology(argv[++i], &config.topology.kind) == EXIT_FAILURE;
+    } else if (strcmp(argv[i], "-d") == 0) {
+      config.topology.degree = (unsigned) atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-r") == 0) {
+      config.rate = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-s") == 0) {
+      config.message_size = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-q") == 0) {
+      config.max_message_queue_length = atol(argv[++i]);
+    } else if (strcmp(argv[i], "-T") == 0) {
+      config.duration_secs = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-R") == 0) {
+      config.reactor_threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-w") == 0) {
+      config.n_workers = (unsigned) atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-F") == 0) {
+      config.forward_ttl = (unsigned) atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-e") == 0) {
+      config.emulation_path = argv[++i];
+    } else if (strcmp(argv[i], "-S") == 0) {
+      config.emulation_seed = strtoul(argv[++i], NULL, 10);
+    } else {
+      usage = 1;
+    }
+  }
+  if (usage || config.n_islands < 2 || config.message_size < 1 || config.n_workers < 1
+      || config.message_size > NETISLANDS_SERVER_BUFFER_LENGTH - 64) {
+    printf("usage: %s [-n islands] [-p base_port] [-t ring|torus|hypercube|random|smallworld] [-d degree]\n"
+           "       [-r messages_per_sec] [-s message_bytes] [-q max_queue_length] [-T secs]\n"
+           "       [-R reactor_threads] [-w driver_threads] [-F forward_ttl] [-e link_emulation_file [-S seed]]\n", argv[0]);
+    printf("  -R 0 shares one reactor thread per core (default), -R -1 gives each island its own\n");
+    printf("  -e impairs links between islands as given in link_emulation_file, seeded by seed\n");
+    return EXIT_FAILURE;
+  }
+  if (config.n_workers > config.n_islands) {
+    config.n_workers = config.n_islands;
+  }
+
+  // start all islands on loopback ports, behind emulated links if requested...
+  if (config.emulation_path != NULL
+      && netislands_load_link_emulation(config.emulation_path, config.emulation_seed) == EXIT_FAILURE) {
+    return EXIT_FAILURE;
+  }
+  if (config.reactor_threads >= 0) {
+    netislands_enable_shared_reactor((unsigned) config.reactor_threads);
+  }
+  const char **hostnames = (const char **) malloc(config.n_islands * sizeof(char *));
+  int *ports = (int *) malloc(config.n_islands * sizeof(int));
+  for (unsigned i = 0; i < config.n_islands; i++) {
+    hostnames[i] = "127.0.0.1";
+    ports[i] = config.base_port + (int) i;
+  }
+  const long base_threads = count_threads(), base_fds = count_fds();
+  Netislands_Island *islands = (Netislands_Island *) malloc(config.n_islands * sizeof(Netislands_Island));
+  long long start = stress_monotonic_usecs();
+  for (unsigned i = 0; i < config.n_islands; i++) {
+    if (island_init_with_topology(&islands[i], config.n_islands, hostnames, ports, i, &config.topology,
+                                  config.max_message_queue_length, 0) == EXIT_FAILURE) {
+      printf("Failed to start island %u on port %d.\n", i, ports[i]);
+      return EXIT_FAILURE;
+    }
+    island_set_timing(&islands[i], 1);
+    island_set_forwarding(&islands[i], config.forward_ttl);
+  }
+  printf("Started %u islands in %.3f s: %ld threads, %ld file descriptors.\n", config.n_islands,
+         (stress_monotonic_usecs() - start) / 1e6, count_threads() - base_threads, count_fds() - base_fds);
+
+  // drive the load and sample resource usage...
+  StressWorker *workers = (StressWorker *) calloc(config.n_workers, sizeof(StressWorker));
+  for (unsigned w = 0; w < config.n_workers; w++) {
+    workers[w].config = &config;
+    workers[w].islands = islands;
+    workers[w].first_island = w;
+    workers[w].island_step = config.n_workers;
+    thrd_create(&workers[w].thread, &stress_worker_main, &workers[w]);
+  }
+  long max_threads = 0, max_fds = 0;
+  unsigned long last_received = 0;
+  start = stress_monotonic_usecs();
+  long long next_report = start + STRESS_REPORT_USECS;
+  while (stress_monotonic_usecs() - start < (long long) (config.duration_secs * 1e6)) {
+    usleep(STRESS_TICK_USECS * 10);
+    const long n_threads = count_threads(), n_fds = count_fds();
+    max_threads = n_threads > max_threads ? n_threads : max_threads;
+    max_fds = n_fds > max_fds ? n_fds : max_fds;
+    if (stress_monotonic_usecs() >= next_report) {
+      unsigned long received = 0;
+      for (unsigned i = 0; i < config.n_islands; i++) {
+        Netislands_Island_Stats stats;
+        island_stats(&islands[i], &stats);
+        received += stats.messages_received;
+      }
+      printf("%6.1f s: %lu messages/s received, %ld threads, %ld file descriptors\n",
+             (stress_monotonic_usecs() - start) / 1e6, received - last_received, n_threads, n_fds);
+      last_received = received;
+      next_report += STRESS_REPORT_USECS;
+    }
+  }
+  for (unsigned w = 0; w < config.n_workers; w++) {
+    workers[w].exit_flag = 1;
+    thrd_join(workers[w].thread, NULL);
+  }
+  const double elapsed_secs = (stress_monotonic_usecs() - start) / 1e6;
+
+  // aggregate and report...
+  Netislands_Island_Stats total;
+  memset(&total, 0, sizeof(total));
+  Netislands_Latency_Histogram network, queueing;
+  memset(&network, 0, sizeof(network));
+  memset(&queueing, 0, sizeof(queueing));
+  Netislands_Neighbor_Latency *latencies = (Netislands_Neighbor_Latency *) malloc(config.n_islands * sizeof(Netislands_Neighbor_Latency));
+  for (unsigned i = 0; i < config.n_islands; i++) {
+    Netislands_Island_Stats stats;
+    island_stats(&islands[i], &stats);
+    total.messages_received += stats.messages_received;
+    total.messages_dropped += stats.messages_dropped;
+    total.messages_sent += stats.messages_sent;
+    total.send_failures += stats.send_failures;
+    total.sends_skipped += stats.sends_skipped;
+    total.messages_relayed += stats.messages_relayed;
+    total.duplicates_dropped += stats.duplicates_dropped;
+    const long n_neighbors = island_latency_stats(&islands[i], latencies, config.n_islands);
+    for (long j = 0; j < n_neighbors && j < (long) config.n_islands; j++) {
+      histogram_merge(&network, &latencies[j].network);
+      histogram_merge(&queueing, &latencies[j].queueing);
+    }
+  }
+  unsigned long n_sends = 0, n_dequeued = 0;
+  long long send_usecs = 0, max_send_usecs = 0;
+  for (unsigned w = 0; w < config.n_workers; w++) {
+    n_sends += workers[w].n_sends;
+    n_dequeued += workers[w].n_dequeued;
+    send_usecs += workers[w].send_usecs;
+    max_send_usecs = workers[w].max_send_usecs > max_send_usecs ? workers[w].max_send_usecs : max_send_usecs;
+  }
+  printf("\n%u islands, %u driver threads, %.1f s, %.1f messages/s per island of %ld bytes\n",
+         config.n_islands, config.n_workers, elapsed_secs, config.rate, config.message_size);
+  printf("Throughput:            %.0f messages/s sent, %.0f messages/s received, %.3f MB/s\n",
+         total.messages_sent / elapsed_secs, total.messages_received / elapsed_secs,
+         total.messages_received * (double) config.message_size / elapsed_secs / 1e6);
+  printf("Drop rate:             %.3f %% (%lu of %lu received messages dropped, %lu dequeued)\n",
+         total.messages_received ? 100.0 * total.messages_dropped / total.messages_received : 0.0,
+         total.messages_dropped, total.messages_received, n_dequeued);
+  printf("Send failures:         %lu, skipped by backpressure: %lu\n", total.send_failures, total.sends_skipped);
+  if (config.forward_ttl > 0) {
+    printf("Forwarding:            %lu messages relayed, %lu duplicates dropped\n",
+           total.messages_relayed, total.duplicates_dropped);
+  }
+  printf("island_send call:      mean %.3f ms, max %.3f ms (%lu calls)\n",
+         n_sends ? send_usecs / 1e3 / n_sends : 0.0, max_send_usecs / 1e3, n_sends);
+  print_histogram("Propagation delay:", &network);
+  print_histogram("Queueing delay:", &queueing);
+#ifndef _WIN32
+  struct rlimit fd_limit;
+  getrlimit(RLIMIT_NOFILE, &fd_limit);
+  printf("Peak usage:            %ld threads, %ld file descriptors (limit %ld)\n",
+         max_threads, max_fds, (long) fd_limit.rlim_cur);
+#endif
+
+  // shut down...
+  start = stress_monotonic_usecs();
+  for (unsigned i = 0; i < config.n_islands; i++) {
+    island_destroy(&islands[i]);
+  }
+  printf("Destroyed %u islands in %.3f s.\n", config.n_islands, (stress_monotonic_usecs() - start) / 1e6);
+  free(latencies);
+  free(workers);
+  free(islands);
+  free(ports);
+  free(hostnames);
+  return EXIT_SUCCESS;
+}
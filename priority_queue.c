@@ -0,0 +1,209 @@
+/* priority_queue.c
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#include "priority_queue.h"
+#include <stdlib.h>
+
+
+// node ordering: lower priority first, among equal priorities newer nodes are considered lower...
+static int node_less(const PriorityQueueNode *a, const PriorityQueueNode *b) {
+  return a->priority < b->priority || (a->priority == b->priority && a->sequence > b->sequence);
+}
+
+// in a min-max heap, nodes on even levels are smaller than all their descendants, nodes on odd
+// levels are greater than all their descendants...
+static int is_min_level(long index) {
+  int level = 0;
+  for (index++; index > 1; index >>= 1) {
+    level++;
+  }
+  return level % 2 == 0;
+}
+
+static void swap_nodes(PriorityQueue *queue, const long a, const long b) {
+  const PriorityQueueNode tmp = queue->nodes[a];
+  queue->nodes[a] = queue->nodes[b];
+  queue->nodes[b] = tmp;
+}
+
+// compare nodes a and b in the direction of the heap level (min levels: a < b, max levels: a > b)...
+static int node_before(const PriorityQueue *queue, const long a, const long b, const int min_level) {
+  return min_level ? node_less(&queue->nodes[a], &queue->nodes[b]) : node_less(&queue->nodes[b], &queue->nodes[a]);
+}
+
+static void bubble_up_level(PriorityQueue *queue, long index, const int min_level) {
+  while (index > 2) {
+    const long grandparent = ((index - 1) / 2 - 1) / 2;
+    if (!node_before(queue, index, grandparent, min_level)) {
+      break;
+    }
+    swap_nodes(queue, index, grandparent);
+    index = grandparent;
+  }
+}
+
+static void bubble_up(PriorityQueue *queue, const long index) {
+  if (index == 0) {
+    return;
+  }
+  const long parent = (index - 1) / 2;
+  const int min_level = is_min_level(index);
+  if (node_before(queue, parent, index, min_level)) { // node belongs to the levels of its parent
+    swap_nodes(queue, index, parent);
+    bubble_up_level(queue, parent, !min_level);
+  } else {
+    bubble_up_level(queue, index, min_level);
+  }
+}
+
+static void trickle_down(PriorityQueue *queue, long index) {
+  const int min_level = is_min_level(index);
+  for (;;) {
+    // find the extreme node among children and grandchildren...
+    const long first_child = 2 * index + 1;
+    if (first_child >= queue->length) {
+      break;
+    }
+    long extreme = first_child;
+    const long candidates[5] = {
+      first_child + 1, 2 * first_child + 1, 2 * first_child + 2, 2 * first_child + 3, 2 * first_child + 4
+    };
+    for (int i = 0; i < 5; i++) {
+      if (candidates[i] < queue->length && node_before(queue, candidates[i], extreme, min_level)) {
+        extreme = candidates[i];
+      }
+    }
+    if (!node_before(queue, extreme, index, min_level)) {
+      break;
+    }
+    swap_nodes(queue, extreme, index);
+    if (extreme <= first_child + 1) { // extreme node was a child
+      break;
+    }
+    // extreme node was a grandchild, restore the order with its parent on the other level kind...
+    const long parent = (extreme - 1) / 2;
+    if (node_before(queue, parent, extreme, min_level)) {
+      swap_nodes(queue, extreme, parent);
+    }
+    index = extreme;
+  }
+}
+
+static int remove_index(PriorityQueue *queue, const long index, double *priority, void **data) {
+  if (priority != NULL) {
+    *priority = queue->nodes[index].priority;
+  }
+  *data = queue->nodes[index].data;
+  queue->length--;
+  if (index < queue->length) {
+    queue->nodes[index] = queue->nodes[queue->length];
+    trickle_down(queue, index);
+  }
+  return EXIT_SUCCESS;
+}
+
+static long max_index(const PriorityQueue *queue) {
+  if (queue->length == 1) {
+    return 0;
+  } else if (queue->length == 2 || node_less(&queue->nodes[2], &queue->nodes[1])) {
+    return 1;
+  } else {
+    return 2;
+  }
+}
+
+int priority_queue_init(PriorityQueue *queue) {
+  queue->nodes = NULL;
+  queue->length = 0;
+  queue->capacity = 0;
+  queue->next_sequence = 0;
+  return EXIT_SUCCESS;
+}
+
+void priority_queue_destroy(PriorityQueue *queue) {
+  free(queue->nodes);
+  priority_queue_init(queue);
+}
+
+long priority_queue_length(const PriorityQueue *queue) {
+  return queue->length;
+}
+
+int priority_queue_insert(PriorityQueue *queue, const double priority, const void *data) {
+  if (queue->length == queue->capacity) {
+    const long new_capacity = queue->capacity ? 2 * queue->capacity : 16;
+    PriorityQueueNode *new_nodes = (PriorityQueueNode *) realloc(queue->nodes, new_capacity * sizeof(PriorityQueueNode));
+    if (NULL == new_nodes) {
+      return EXIT_FAILURE;
+    }
+    queue->nodes = new_nodes;
+    queue->capacity = new_capacity;
+  }
+  PriorityQueueNode *node = &queue->nodes[queue->length];
+  node->priority = priority;
+  node->sequence = queue->next_sequence++;
+  node->data = (void *) data;
+  queue->length++;
+  bubble_up(queue, queue->length - 1);
+  return EXIT_SUCCESS;
+}
+
+int priority_queue_peek_min(const PriorityQueue *queue, double *priority, void **data) {
+  if (queue->length == 0) {
+    return EXIT_FAILURE;
+  }
+  if (priority != NULL) {
+    *priority = queue->nodes[0].priority;
+  }
+  if (data != NULL) {
+    *data = queue->nodes[0].data;
+  }
+  return EXIT_SUCCESS;
+}
+
+int priority_queue_remove_min(PriorityQueue *queue, double *priority, void **data) {
+  if (queue->length == 0) { // cannot remove from an empty queue
+    return EXIT_FAILURE;
+  }
+  return remove_index(queue, 0, priority, data);
+}
+
+int priority_queue_remove_max(PriorityQueue *queue, double *priority, void **data) {
+  if (queue->length == 0) { // cannot remove from an empty queue
+    return EXIT_FAILURE;
+  }
+  return remove_index(queue, max_index(queue), priority, data);
+}
+
+
+// test code...
+#ifdef PRIORITY_QUEUE_TEST
+#include <stdio.h>
+
+int main() {
+  printf("Welcome to the PriorityQueue test program!\n");
+  PriorityQueue q;
+  priority_queue_init(&q);
+  const double priorities[10] = {5.0, 1.0, 9.0, 3.0, 7.0, 3.0, 8.0, 0.5, 6.0, 2.0};
+  const char *names[10] = {"five", "one", "nine", "three", "seven", "three (newer)", "eight", "half", "six", "two"};
+  for (int i = 0; i < 10; i++) {
+    priority_queue_insert(&q, priorities[i], names[i]);
+  }
+  printf("Inserted 10 elements. Current length: %ld\n", priority_queue_length(&q));
+  double priority;
+  char *element;
+  priority_queue_remove_min(&q, &priority, (void **) &element);
+  printf("Removed min: %s (%g)\n", element, priority);
+  priority_queue_remove_min(&q, &priority, (void **) &element);
+  printf("Removed min: %s (%g)\n", element, priority);
+  printf("Removing max until the queue is empty...\n");
+  while (priority_queue_length(&q) > 0) {
+    priority_queue_remove_max(&q, &priority, (void **) &element);
+    printf("...removed max: %s (%g)\n", element, priority);
+  }
+  priority_queue_destroy(&q);
+  printf("All done, exiting.\n");
+  return EXIT_SUCCESS;
+}
+#endif
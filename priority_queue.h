@@ -0,0 +1,37 @@
+/* priority_queue.h
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#ifndef PRIORITY_QUEUE_H
+#define PRIORITY_QUEUE_H
+
+
+typedef struct {
+  double priority;
+  unsigned long sequence; // insertion order, older elements win ties
+  void *data;
+} PriorityQueueNode;
+
+// a double-ended priority queue (min-max heap), supporting O(log n) insertion and
+// removal of both the element of lowest and the element of highest priority...
+typedef struct {
+  PriorityQueueNode *nodes;
+  long length;
+  long capacity;
+  unsigned long next_sequence;
+} PriorityQueue;
+
+
+int priority_queue_init(PriorityQueue *queue);
+void priority_queue_destroy(PriorityQueue *queue);
+
+long priority_queue_length(const PriorityQueue *queue);
+
+int priority_queue_insert(PriorityQueue *queue, const double priority, const void *data);
+
+int priority_queue_peek_min(const PriorityQueue *queue, double *priority, void **data);
+int priority_queue_remove_min(PriorityQueue *queue, double *priority, void **data);
+int priority_queue_remove_max(PriorityQueue *queue, double *priority, void **data);
+
+
+#endif
@@ -0,0 +1,761 @@
+/* reactor.c
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#include "reactor.h"
+
+#ifdef _WIN32
+  #define _WIN32_WINNT 0x600 // WSAPoll
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+  #include <windows.h>
+  #define close(a) closesocket(a)
+  #define poll WSAPoll
+  typedef WSAPOLLFD pollfd_t;
+#else
+  #include <unistd.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #ifdef __linux__
+    #include <sys/eventfd.h>
+  #endif
+  #include <sys/types.h>
+  #include <sys/socket.h>
+  #include <netinet/in.h>
+  #include <netinet/tcp.h>
+  typedef struct pollfd pollfd_t;
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+
+// token buckets of a client host, holding up to one second's worth of its rates...
+typedef struct RateBucket {
+  unsigned char host[16]; // IPv4 or IPv6 address, IPv4 addresses zero padded
+  int family;
+  unsigned long key; // of the client on its host, 0 without a key offset
+  double message_tokens;
+  double byte_tokens;
+  long long refill_msecs;
+  long n_connections; // connections reading with the byte tokens, the buckets are kept while there are any
+  struct RateBucket *next; // in the hash chain
+} RateBucket;
+
+typedef struct {
+  int fd;
+  ReactorListenerOptions options;
+  RateBucket **buckets; // REACTOR_RATE_BUCKETS hash chains of client hosts, NULL without rate limits
+  ReactorMessageHandler on_message;
+  ReactorStreamHandler on_stream; // NULL if messages longer than max_message_length are dropped
+  ReactorTickHandler on_tick;
+  void *context;
+} ReactorListener;
+
+typedef struct {
+  int fd;
+  int listenfd;
+  struct sockaddr_storage client_address;
+  char *buffer;
+  long length;
+  long capacity;
+  long max_length; // maximum message length of the listener
+  RateBucket *bucket; // of the client, NULL without a byte rate limit
+  int keyed; // the buckets of the client are known, they are found once its key has been read
+  long long throttled_until; // not polled before then, while the client host is out of byte tokens
+  int paused; // by the stream handler, not polled until the stream is resumed
+  void *stream; // state of the stream handler, NULL while receiving a message
+} ReactorConnection;
+
+struct ReactorThread {
+  Reactor *reactor;
+  thrd_t thread;
+  mtx_t mutex; // held while events are processed, not while polling
+  int exit_flag; // set with __atomic operations, checked between two events
+  int n_waiters; // threads waiting for the mutex (__atomic), the event loop yields to them between two events
+  int wakefds[2]; // eventfd (both ends) or self-pipe to interrupt poll, e.g. when a listener is added
+  unsigned long generation; // incremented whenever a listener is removed
+  ReactorListener *listeners;
+  long n_listeners;
+  long listeners_capacity;
+  ReactorConnection *connections;
+  long n_connections;
+  long connections_capacity;
+  long long last_tick;
+};
+
+
+static long long reactor_monotonic_msecs() {
+#ifdef _WIN32
+  return (long long) GetTickCount();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
+}
+
+static int set_nonblocking(const int fd) {
+#ifdef _WIN32
+  u_long mode = 1;
+  return ioctlsocket(fd, FIONBIO, &mode) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
+  const int flags = fcntl(fd, F_GETFL, 0);
+  return (flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1) ? EXIT_SUCCESS : EXIT_FAILURE;
+#endif
+}
+
+static int would_block() {
+#ifdef _WIN32
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+static int open_wakefds(int wakefds[2]) {
+#if defined(_WIN32)
+  wakefds[0] = wakefds[1] = -1; // no pipes in the poll set, wakeups have to wait for the poll timeout
+  return EXIT_SUCCESS;
+#elif defined(__linux__)
+  if ((wakefds[0] = wakefds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+#else
+  if (pipe(wakefds) == -1) {
+    return EXIT_FAILURE;
+  }
+  fcntl(wakefds[0], F_SETFL, fcntl(wakefds[0], F_GETFL, 0) | O_NONBLOCK);
+  fcntl(wakefds[1], F_SETFL, fcntl(wakefds[1], F_GETFL, 0) | O_NONBLOCK);
+  return EXIT_SUCCESS;
+#endif
+}
+
+static void close_wakefds(int wakefds[2]) {
+  if (wakefds[0] != -1) {
+    close(wakefds[0]);
+    if (wakefds[1] != wakefds[0]) {
+      close(wakefds[1]);
+    }
+  }
+}
+
+static void wake_thread(ReactorThread *thread) {
+#if defined(__linux__)
+  const uint64_t one = 1;
+  if (write(thread->wakefds[1], &one, sizeof(one)) == -1) {
+    // counter saturated, the thread will wake up anyway
+  }
+#elif !defined(_WIN32)
+  const char byte = 0;
+  if (write(thread->wakefds[1], &byte, 1) == -1) {
+    // pipe full, the thread will wake up anyway
+  }
+#endif
+}
+
+static void drain_wakefd(ReactorThread *thread) {
+#if defined(__linux__)
+  uint64_t count;
+  if (read(thread->wakefds[0], &count, sizeof(count)) == -1) {
+    // already drained
+  }
+#elif !defined(_WIN32)
+  char bytes[64];
+  while (read(thread->wakefds[0], bytes, sizeof(bytes)) > 0) {
+  }
+#endif
+}
+
+// take the lock of a reactor thread, its event loop yields to us between two events instead of
+// processing all events of its current poll first...
+static void lock_thread(ReactorThread *thread) {
+  __atomic_add_fetch(&thread->n_waiters, 1, __ATOMIC_SEQ_CST);
+  mtx_lock(&thread->mutex);
+  __atomic_sub_fetch(&thread->n_waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+// returns 1 if the event loop should stop processing the events of its current poll...
+static int thread_interrupted(ReactorThread *thread) {
+  return __atomic_load_n(&thread->exit_flag, __ATOMIC_ACQUIRE) || __atomic_load_n(&thread->n_waiters, __ATOMIC_SEQ_CST) > 0;
+}
+
+// buckets hold at least one message (byte), so that rates below one per second are possible...
+static double max_tokens(const double per_sec) {
+  return per_sec > 1.0 ? per_sec : 1.0;
+}
+
+// add the tokens earned since the last refill...
+static void refill_bucket(const ReactorListener *listener, RateBucket *bucket, const long long now) {
+  const ReactorListenerOptions *options = &listener->options;
+  const double elapsed_secs = (now - bucket->refill_msecs) / 1000.0;
+  bucket->message_tokens += elapsed_secs * options->messages_per_sec;
+  if (bucket->message_tokens > max_tokens(options->messages_per_sec)) {
+    bucket->message_tokens = max_tokens(options->messages_per_sec);
+  }
+  bucket->byte_tokens += elapsed_secs * options->bytes_per_sec;
+  if (bucket->byte_tokens > max_tokens(options->bytes_per_sec)) {
+    bucket->byte_tokens = max_tokens(options->bytes_per_sec);
+  }
+  bucket->refill_msecs = now;
+}
+
+// find the token buckets of a client (new clients get full ones) and refill them...
+static RateBucket *find_bucket(const ReactorListener *listener, const struct sockaddr_storage *client_address,
+                               const unsigned long key) {
+  unsigned char host[16];
+  memset(host, 0, sizeof(host));
+  if (client_address->ss_family == AF_INET6) {
+    memcpy(host, &((const struct sockaddr_in6 *) client_address)->sin6_addr, 16);
+  } else {
+    memcpy(host, &((const struct sockaddr_in *) client_address)->sin_addr, 4);
+  }
+  unsigned long hash = 2166136261UL; // FNV-1a
+  for (int i = 0; i < 16; i++) {
+    hash = (hash ^ host[i]) * 16777619UL;
+  }
+  for (int i = 0; i < 4; i++) {
+    hash = (hash ^ ((key >> (8 * i)) & 0xff)) * 16777619UL;
+  }
+  RateBucket **chain = &listener->buckets[hash % REACTOR_RATE_BUCKETS];
+  const long long now = reactor_monotonic_msecs();
+  for (RateBucket *bucket = *chain; bucket != NULL; bucket = bucket->next) {
+    if (bucket->family == client_address->ss_family && bucket->key == key
+        && memcmp(bucket->host, host, sizeof(host)) == 0) {
+      refill_bucket(listener, bucket, now);
+      return bucket;
+    }
+  }
+  RateBucket *bucket = (RateBucket *) malloc(sizeof(RateBucket));
+  if (NULL == bucket) {
+    return NULL;
+  }
+  memcpy(bucket->host, host, sizeof(host));
+  bucket->family = client_address->ss_family;
+  bucket->key = key;
+  bucket->message_tokens = max_tokens(listener->options.messages_per_sec);
+  bucket->byte_tokens = max_tokens(listener->options.bytes_per_sec);
+  bucket->refill_msecs = now;
+  bucket->n_connections = 0;
+  bucket->next = *chain;
+  *chain = bucket;
+  return bucket;
+}
+
+// free the buckets of hosts without connections that have refilled completely, a host coming back
+// gets the same full buckets anew...
+static void expire_buckets(const ReactorListener *listener, const long long now) {
+  const double max_message_tokens = max_tokens(listener->options.messages_per_sec);
+  const double max_byte_tokens = max_tokens(listener->options.bytes_per_sec);
+  for (long i = 0; i < REACTOR_RATE_BUCKETS; i++) {
+    RateBucket **link = &listener->buckets[i];
+    while (*link != NULL) {
+      RateBucket *bucket = *link;
+      refill_bucket(listener, bucket, now);
+      if (bucket->n_connections == 0 && bucket->message_tokens >= max_message_tokens
+          && bucket->byte_tokens >= max_byte_tokens) {
+        *link = bucket->next;
+        free(bucket);
+      } else {
+        link = &bucket->next;
+      }
+    }
+  }
+}
+
+static void free_buckets(ReactorListener *listener) {
+  if (listener->buckets != NULL) {
+    for (long i = 0; i < REACTOR_RATE_BUCKETS; i++) {
+      while (listener->buckets[i] != NULL) {
+        RateBucket *bucket = listener->buckets[i];
+        listener->buckets[i] = bucket->next;
+        free(bucket);
+      }
+    }
+    free(listener->buckets);
+    listener->buckets = NULL;
+  }
+}
+
+static void count_rejected(const ReactorListener *listener) {
+  if (listener->options.rejected != NULL) {
+    __atomic_fetch_add(listener->options.rejected, 1, __ATOMIC_RELAXED);
+  }
+}
+
+// take a message token from the buckets of a client, returns NULL (and counts the rejection) if it
+// is over its message rate, otherwise its buckets to read with (NULL without a byte rate limit)...
+static RateBucket *admit_client(const ReactorListener *listener, const struct sockaddr_storage *client_address,
+                                const unsigned long key, int *rejected) {
+  RateBucket *bucket = find_bucket(listener, client_address, key);
+  *rejected = NULL == bucket;
+  if (bucket != NULL && listener->options.messages_per_sec > 0.0) {
+    if (bucket->message_tokens < 1.0) {
+      count_rejected(listener);
+      *rejected = 1;
+      return NULL;
+    }
+    bucket->message_tokens -= 1.0;
+  }
+  if (NULL == bucket || listener->options.bytes_per_sec <= 0.0) {
+    return NULL;
+  }
+  bucket->n_connections++;
+  return bucket;
+}
+
+// close a connection with a reset rather than a FIN, so that a client still sending sees a failure...
+static void reset_connection(const int fd) {
+  struct linger option_value;
+  option_value.l_onoff = 1;
+  option_value.l_linger = 0;
+  setsockopt(fd, SOL_SOCKET, SO_LINGER, (const char *) &option_value, sizeof option_value);
+}
+
+static const ReactorListener *find_listener(const ReactorThread *thread, const int listenfd) {
+  for (long i = 0; i < thread->n_listeners; i++) {
+    if (thread->listeners[i].fd == listenfd) {
+      return &thread->listeners[i];
+    }
+  }
+  return NULL;
+}
+
+static void close_connection(ReactorThread *thread, const long index) {
+  // this assumes that we have a mutex lock on thread!
+  ReactorConnection *connection = &thread->connections[index];
+  if (connection->stream != NULL) { // stream cut off, let its handler clean up
+    const ReactorListener *listener = find_listener(thread, connection->listenfd);
+    if (listener != NULL) {
+      listener->on_stream(listener->context, &connection->stream, NULL, 0, REACTOR_STREAM_ABORT,
+                          &connection->client_address);
+    }
+  }
+  if (connection->bucket != NULL) {
+    connection->bucket->n_connections--;
+  }
+  close(connection->fd);
+  free(connection->buffer);
+  thread->connections[index] = thread->connections[--thread->n_connections];
+}
+
+static void accept_connections(ReactorThread *thread, const ReactorListener *listener) {
+  for (;;) {
+    struct sockaddr_storage client_address;
+    socklen_t client_address_length = sizeof(client_address);
+    const int connfd = accept(listener->fd, (struct sockaddr *) &client_address, &client_address_length);
+    if (connfd == -1) {
+#ifdef NETISLANDS_DEBUG
+      if (!would_block()) {
+        perror("accept"); // e.g. out of file descriptors, pending connections are retried later
+      }
+#endif
+      return;
+    }
+#ifdef NETISLANDS_DEBUG
+    fprintf(stderr, "+ Server accepted a connection.\n");
+#endif
+    RateBucket *bucket = NULL;
+    const int keyed = NULL == listener->buckets || listener->options.key_offset < 0;
+    if (listener->buckets != NULL && keyed) { // reject connections over the client host's message rate unread
+      int rejected;
+      bucket = admit_client(listener, &client_address, 0, &rejected);
+      if (rejected) {
+        reset_connection(connfd);
+        close(connfd);
+        continue;
+      }
+    }
+    if (set_nonblocking(connfd) == EXIT_FAILURE) {
+      close(connfd);
+      continue;
+    }
+#ifdef TCP_QUICKACK
+    if (listener->options.quickack) {
+      const int option_value = 1;
+      setsockopt(connfd, IPPROTO_TCP, TCP_QUICKACK, &option_value, sizeof option_value);
+    }
+#endif
+    if (thread->n_connections == thread->connections_capacity) {
+      thread->connections_capacity = thread->connections_capacity ? 2 * thread->connections_capacity : 16;
+      thread->connections = (ReactorConnection *) realloc(thread->connections,
+                                                          thread->connections_capacity * sizeof(ReactorConnection));
+    }
+    ReactorConnection *connection = &thread->connections[thread->n_connections++];
+    connection->fd = connfd;
+    connection->listenfd = listener->fd;
+    connection->client_address = client_address;
+    connection->buffer = NULL;
+    connection->length = 0;
+    connection->capacity = 0;
+    connection->max_length = listener->options.max_message_length;
+    connection->bucket = bucket;
+    connection->keyed = keyed;
+    connection->throttled_until = 0;
+    connection->paused = 0;
+    connection->stream = NULL;
+  }
+}
+
+// offer the received data of a connection to the stream handler, returns 1 if it was delivered to a
+// stream, 0 if the connection is no stream and -1 if the handler dropped it...
+static int deliver_stream_data(ReactorThread *thread, ReactorConnection *connection, const int status) {
+  const ReactorListener *listener = find_listener(thread, connection->listenfd);
+  if (NULL == listener || NULL == listener->on_stream) {
+    return 0;
+  }
+  const int ret = listener->on_stream(listener->context, &connection->stream, connection->buffer, connection->length,
+                                      status, &connection->client_address);
+  if (ret == -1) {
+    connection->stream = NULL;
+    return -1;
+  }
+  if (NULL == connection->stream) {
+    return 0;
+  }
+  if (ret & REACTOR_STREAM_PAUSE) {
+    connection->paused = 1;
+  }
+  if (ret & 1) { // the handler took over the buffer
+    connection->buffer = NULL;
+    connection->capacity = 0;
+  }
+  connection->length = 0;
+  return 1;
+}
+
+// read what is available on a connection, returns EXIT_FAILURE when the connection is done...
+static int receive_available(ReactorThread *thread, ReactorConnection *connection) {
+  const long max_message_length = connection->max_length;
+  for (;;) {
+    if (connection->length == connection->capacity) { // grow the buffer up to the maximum message length
+      if (connection->capacity >= max_message_length) {
+        // pass the data on to the stream handler, then let the other connections have their turn...
+        if (deliver_stream_data(thread, connection, REACTOR_STREAM_MORE) != 1) {
+#ifdef NETISLANDS_DEBUG
+          fprintf(stderr, "Message exceeds maximum message length, ignoring message. (%s line# %d)\n", __FILE__, __LINE__);
+#endif
+          return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+      }
+      // streams get buffers of the maximum message length right away...
+      long new_capacity = connection->stream != NULL ? max_message_length
+        : connection->capacity ? 2 * connection->capacity : REACTOR_INITIAL_BUFFER_LENGTH;
+      if (new_capacity > max_message_length) {
+        new_capacity = max_message_length;
+      }
+      char *new_buffer = (char *) realloc(connection->buffer, new_capacity);
+      if (NULL == new_buffer) {
+        return EXIT_FAILURE;
+      }
+      connection->buffer = new_buffer;
+      connection->capacity = new_capacity;
+    }
+    long receive_length = connection->capacity - connection->length;
+    if (!connection->keyed) { // read no further than the key before the client's buckets are known
+      const ReactorListener *listener = find_listener(thread, connection->listenfd);
+      const long key_end = listener->options.key_offset + 4;
+      if (connection->length >= key_end) {
+        const unsigned char *key_bytes = (const unsigned char *) connection->buffer + listener->options.key_offset;
+        const unsigned long key = (unsigned long) key_bytes[0] << 24 | (unsigned long) key_bytes[1] << 16
+          | (unsigned long) key_bytes[2] << 8 | (unsigned long) key_bytes[3];
+        int rejected;
+        connection->bucket = admit_client(listener, &connection->client_address, key, &rejected);
+        connection->keyed = 1;
+        if (rejected) {
+          reset_connection(connection->fd);
+          return EXIT_FAILURE;
+        }
+        if (connection->bucket != NULL) { // the key counts towards the bytes, too
+          connection->bucket->byte_tokens -= connection->length;
+        }
+        continue;
+      }
+      receive_length = key_end - connection->length;
+    } else if (connection->bucket != NULL) { // read no more than the client host's byte rate allows
+      const ReactorListener *listener = find_listener(thread, connection->listenfd);
+      const long long now = reactor_monotonic_msecs();
+      refill_bucket(listener, connection->bucket, now);
+      if (connection->bucket->byte_tokens < 1.0) {
+        // stop reading until the bucket has refilled for a buffer (or a second) worth of bytes, the
+        // rest waits in the socket buffers and slows the client down...
+        double wanted_tokens = max_tokens(listener->options.bytes_per_sec);
+        if (wanted_tokens > REACTOR_INITIAL_BUFFER_LENGTH) {
+          wanted_tokens = REACTOR_INITIAL_BUFFER_LENGTH;
+        }
+        connection->throttled_until = now + 1
+          + (long long) ((wanted_tokens - connection->bucket->byte_tokens) * 1000.0 / listener->options.bytes_per_sec);
+        if (connection->length > 0 && deliver_stream_data(thread, connection, REACTOR_STREAM_MORE) == -1) {
+          return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+      }
+      if (receive_length > (long) connection->bucket->byte_tokens) {
+        receive_length = (long) connection->bucket->byte_tokens;
+      }
+    }
+    const long bytes_received = (long) recv(connection->fd, connection->buffer + connection->length,
+                                            receive_length, 0);
+    if (bytes_received > 0) {
+      connection->length += bytes_received;
+      if (connection->bucket != NULL) {
+        connection->bucket->byte_tokens -= bytes_received;
+      }
+    } else if (bytes_received == 0) { // client closed the connection, message complete
+      if (connection->stream != NULL) {
+        deliver_stream_data(thread, connection, REACTOR_STREAM_END);
+        connection->stream = NULL;
+        return EXIT_FAILURE;
+      }
+      const ReactorListener *listener = find_listener(thread, connection->listenfd);
+      if (listener != NULL
+          && listener->on_message(listener->context, connection->buffer, connection->length, &connection->client_address)) {
+        connection->buffer = NULL; // the handler took over the buffer
+      }
+      return EXIT_FAILURE;
+    } else if (would_block()) {
+      // hand what we have to a stream right away (which also tells streams from messages early)...
+      if (connection->keyed && connection->length > 0
+          && deliver_stream_data(thread, connection, REACTOR_STREAM_MORE) == -1) {
+        return EXIT_FAILURE;
+      }
+      return EXIT_SUCCESS;
+    } else {
+#ifdef NETISLANDS_DEBUG
+      perror("recv");
+      fprintf(stderr, "Network error while receiving netislands message, ignoring message. (%s line# %d)\n", __FILE__, __LINE__);
+#endif
+      return EXIT_FAILURE;
+    }
+  }
+}
+
+static int reactor_thread_main(void *args) {
+  ReactorThread *thread = (ReactorThread *) args;
+  pollfd_t *pollfds = NULL;
+  long pollfds_capacity = 0;
+  mtx_lock(&thread->mutex);
+  while (!__atomic_load_n(&thread->exit_flag, __ATOMIC_ACQUIRE)) {
+    // poll all listening sockets and connections of this thread...
+    const long n_listeners = thread->n_listeners, n_connections = thread->n_connections;
+    if (n_listeners + n_connections + 1 > pollfds_capacity) {
+      pollfds_capacity = 2 * (n_listeners + n_connections + 1);
+      pollfds = (pollfd_t *) realloc(pollfds, pollfds_capacity * sizeof(pollfd_t));
+    }
+    for (long i = 0; i < n_listeners; i++) {
+      pollfds[i].fd = thread->listeners[i].fd;
+      pollfds[i].events = POLLIN;
+      pollfds[i].revents = 0;
+    }
+    // ...except paused connections and throttled ones (poll ignores negative fds), until they may
+    // read again...
+    long long now = reactor_monotonic_msecs();
+    int poll_timeout_msecs = thread->reactor->poll_timeout_msecs;
+    for (long i = 0; i < n_connections; i++) {
+      const long long throttled_msecs = thread->connections[i].throttled_until - now;
+      pollfds[n_listeners + i].fd = throttled_msecs > 0 || thread->connections[i].paused ? -1 : thread->connections[i].fd;
+      pollfds[n_listeners + i].events = POLLIN;
+      pollfds[n_listeners + i].revents = 0;
+      if (throttled_msecs > 0 && (poll_timeout_msecs < 0 || throttled_msecs < poll_timeout_msecs)) {
+        poll_timeout_msecs = (int) throttled_msecs;
+      }
+    }
+    const long n_pollfds = n_listeners + n_connections + (thread->wakefds[0] != -1);
+    pollfds[n_listeners + n_connections].fd = thread->wakefds[0];
+    pollfds[n_listeners + n_connections].events = POLLIN;
+    pollfds[n_listeners + n_connections].revents = 0;
+    const unsigned long generation = thread->generation;
+    mtx_unlock(&thread->mutex);
+    while (__atomic_load_n(&thread->n_waiters, __ATOMIC_SEQ_CST) > 0) { // let them take the lock first
+      thrd_yield();
+    }
+    const int poll_ret = poll(pollfds, n_pollfds, poll_timeout_msecs);
+    mtx_lock(&thread->mutex);
+    if (pollfds[n_listeners + n_connections].revents != 0) {
+      drain_wakefd(thread);
+    }
+    if (poll_ret == -1) {
+#ifdef NETISLANDS_DEBUG
+      perror("poll");
+#endif
+      continue;
+    }
+    if (thread->generation != generation) { // listeners removed while polling, events may be stale
+      continue;
+    }
+    // read connections first (in reverse order, as closing a connection moves the last one). events
+    // left over when interrupted are polled again...
+    for (long i = n_connections - 1; i >= 0 && !thread_interrupted(thread); i--) {
+      if (pollfds[n_listeners + i].revents != 0
+          && receive_available(thread, &thread->connections[i]) == EXIT_FAILURE) {
+        close_connection(thread, i);
+      }
+    }
+    // ...then accept new connections...
+    for (long i = 0; i < n_listeners && !thread_interrupted(thread); i++) {
+      if (pollfds[i].revents & POLLIN) {
+        accept_connections(thread, &thread->listeners[i]);
+      }
+    }
+    // ...and finally do periodic housekeeping...
+    now = reactor_monotonic_msecs();
+    if (now - thread->last_tick >= REACTOR_TICK_MSECS && !thread_interrupted(thread)) {
+      thread->last_tick = now;
+      for (long i = 0; i < thread->n_listeners; i++) {
+        if (thread->listeners[i].buckets != NULL) {
+          expire_buckets(&thread->listeners[i], now);
+        }
+        if (thread->listeners[i].on_tick != NULL) {
+          thread->listeners[i].on_tick(thread->listeners[i].context);
+        }
+      }
+    }
+  }
+  mtx_unlock(&thread->mutex);
+  free(pollfds);
+#ifdef NETISLANDS_DEBUG
+  fprintf(stderr, "Reactor thread clean exit.\n");
+#endif
+  return EXIT_SUCCESS;
+}
+
+int reactor_init(Reactor *reactor, const unsigned n_threads, const int poll_timeout_msecs) {
+  reactor->n_threads = n_threads > 0 ? n_threads : 1;
+  reactor->poll_timeout_msecs = poll_timeout_msecs;
+  reactor->threads = (ReactorThread *) calloc(reactor->n_threads, sizeof(ReactorThread));
+  for (unsigned i = 0; i < reactor->n_threads; i++) {
+    ReactorThread *thread = &reactor->threads[i];
+    thread->reactor = reactor;
+    mtx_init(&thread->mutex, mtx_plain);
+    if (open_wakefds(thread->wakefds) == EXIT_FAILURE) {
+      reactor->n_threads = i;
+      mtx_destroy(&thread->mutex);
+      reactor_destroy(reactor);
+      return EXIT_FAILURE;
+    }
+    if (thrd_create(&thread->thread, &reactor_thread_main, thread) != thrd_success) {
+#ifdef NETISLANDS_DEBUG
+      perror("thrd_create");
+#endif
+      reactor->n_threads = i;
+      close_wakefds(thread->wakefds);
+      mtx_destroy(&thread->mutex);
+      reactor_destroy(reactor);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+int reactor_destroy(Reactor *reactor) {
+  for (unsigned i = 0; i < reactor->n_threads; i++) {
+    ReactorThread *thread = &reactor->threads[i];
+    // signal the reactor thread to exit, it stops after the event it is processing...
+    __atomic_store_n(&thread->exit_flag, 1, __ATOMIC_RELEASE);
+    wake_thread(thread);
+    thrd_join(thread->thread, NULL); // wait for the reactor thread to exit
+    while (thread->n_connections > 0) {
+      close_connection(thread, thread->n_connections - 1);
+    }
+    free(thread->connections);
+    for (long j = 0; j < thread->n_listeners; j++) {
+      free_buckets(&thread->listeners[j]);
+    }
+    free(thread->listeners);
+    close_wakefds(thread->wakefds);
+    mtx_destroy(&thread->mutex);
+  }
+  free(reactor->threads);
+  reactor->threads = NULL;
+  reactor->n_threads = 0;
+  return EXIT_SUCCESS;
+}
+
+int reactor_add_listener(Reactor *reactor, const int listenfd, const ReactorListenerOptions *options,
+                         const ReactorMessageHandler on_message, const ReactorStreamHandler on_stream,
+                         const ReactorTickHandler on_tick, void *context) {
+  if (set_nonblocking(listenfd) == EXIT_FAILURE) {
+    return EXIT_FAILURE;
+  }
+  // assign the listener to the thread serving the fewest listeners (counted under each thread's lock)...
+  ReactorThread *thread = &reactor->threads[0];
+  long fewest = -1;
+  for (unsigned i = 0; i < reactor->n_threads; i++) {
+    lock_thread(&reactor->threads[i]);
+    const long n_listeners = reactor->threads[i].n_listeners;
+    mtx_unlock(&reactor->threads[i].mutex);
+    if (fewest < 0 || n_listeners < fewest) {
+      thread = &reactor->threads[i];
+      fewest = n_listeners;
+    }
+  }
+  lock_thread(thread);
+  if (thread->n_listeners == thread->listeners_capacity) {
+    const long capacity = thread->listeners_capacity ? 2 * thread->listeners_capacity : 4;
+    ReactorListener *listeners = (ReactorListener *) realloc(thread->listeners, capacity * sizeof(ReactorListener));
+    if (listeners == NULL) {
+      mtx_unlock(&thread->mutex);
+      return EXIT_FAILURE;
+    }
+    thread->listeners = listeners;
+    thread->listeners_capacity = capacity;
+  }
+  ReactorListener *listener = &thread->listeners[thread->n_listeners++];
+  listener->fd = listenfd;
+  listener->options = *options;
+  listener->buckets = options->messages_per_sec > 0.0 || options->bytes_per_sec > 0.0
+    ? (RateBucket **) calloc(REACTOR_RATE_BUCKETS, sizeof(RateBucket *)) : NULL;
+  listener->on_message = on_message;
+  listener->on_stream = on_stream;
+  listener->on_tick = on_tick;
+  listener->context = context;
+  wake_thread(thread); // poll the new listener right away
+  mtx_unlock(&thread->mutex);
+  return EXIT_SUCCESS;
+}
+
+int reactor_remove_listener(Reactor *reactor, const int listenfd) {
+  for (unsigned i = 0; i < reactor->n_threads; i++) {
+    ReactorThread *thread = &reactor->threads[i];
+    // once we hold the lock, no handler of this listener is running or will run again...
+    lock_thread(thread);
+    for (long j = 0; j < thread->n_listeners; j++) {
+      if (thread->listeners[j].fd == listenfd) {
+        for (long k = thread->n_connections - 1; k >= 0; k--) { // drop pending connections (and streams)
+          if (thread->connections[k].listenfd == listenfd) {
+            close_connection(thread, k);
+          }
+        }
+        free_buckets(&thread->listeners[j]);
+        thread->listeners[j] = thread->listeners[--thread->n_listeners];
+        thread->generation++;
+        mtx_unlock(&thread->mutex);
+        return EXIT_SUCCESS;
+      }
+    }
+    mtx_unlock(&thread->mutex);
+  }
+  return EXIT_FAILURE; // listener not found
+}
+
+// poll a paused stream connection again...
+int reactor_resume_stream(Reactor *reactor, const void *stream) {
+  for (unsigned i = 0; i < reactor->n_threads; i++) {
+    ReactorThread *thread = &reactor->threads[i];
+    lock_thread(thread);
+    for (long j = 0; j < thread->n_connections; j++) {
+      if (thread->connections[j].stream == stream) {
+        thread->connections[j].paused = 0;
+        wake_thread(thread);
+        mtx_unlock(&thread->mutex);
+        return EXIT_SUCCESS;
+      }
+    }
+    mtx_unlock(&thread->mutex);
+  }
+  return EXIT_FAILURE; // connection already closed
+}
@@ -0,0 +1,76 @@
+/* reactor.h
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "tinycthread.h"
+
+
+#define REACTOR_INITIAL_BUFFER_LENGTH 4096
+#define REACTOR_TICK_MSECS 100 // minimum interval between two calls of a listener's tick handler
+#define REACTOR_RATE_BUCKETS 256 // hash chains of the token buckets of client hosts per rate limited listener
+
+// status of the data passed to a stream handler...
+#define REACTOR_STREAM_MORE 0
+#define REACTOR_STREAM_END 1   // client closed the connection after this data
+#define REACTOR_STREAM_ABORT 2 // connection dropped (no data), e.g. on a network error or when the listener is removed
+
+// or'ed into the return value of a stream handler to stop reading the connection until
+// reactor_resume_stream is called...
+#define REACTOR_STREAM_PAUSE 2
+
+
+struct sockaddr_storage;
+
+// called with a complete message (everything a client sent until it closed the connection), the
+// message buffer is malloc'ed, a handler that keeps it returns 1 and has to free it later...
+typedef int (*ReactorMessageHandler)(void *context, char *message, const long message_length,
+                                     const struct sockaddr_storage *client_address);
+// called with the data received on a connection so far whenever no more is available for the
+// moment or max_message_length bytes have arrived, and with the rest when the client closes the
+// connection (REACTOR_STREAM_END). a handler that takes the connection as a stream stores its state
+// in *stream (NULL until then), connections not taken are received as messages. like the message
+// handler, a handler that keeps the data buffer returns 1, a handler returning -1 drops the
+// connection and is not called again for it. a stream whose reader falls behind is paused with
+// REACTOR_STREAM_PAUSE, the client then waits for the socket buffers to drain...
+typedef int (*ReactorStreamHandler)(void *context, void **stream, char *data, const long length, const int status,
+                                    const struct sockaddr_storage *client_address);
+// called periodically, for housekeeping work...
+typedef void (*ReactorTickHandler)(void *context);
+
+typedef struct ReactorThread ReactorThread;
+
+// a set of event loop threads serving the listening sockets (and their connections) of many
+// listeners, each listener is served by exactly one thread...
+typedef struct Reactor {
+  ReactorThread *threads;
+  unsigned n_threads;
+  int poll_timeout_msecs;
+} Reactor;
+
+// per listener settings...
+typedef struct {
+  long max_message_length; // longer messages are dropped
+  int quickack;            // acknowledge received data immediately (Linux only)
+  double messages_per_sec; // connections accepted per client host and second, 0 for unlimited
+  double bytes_per_sec;    // bytes received per client host and second (reading pauses beyond), 0 for unlimited
+  unsigned long *rejected; // counts (atomically) the connections rejected by the message rate, may be NULL
+  long key_offset;         // of a 4-byte big-endian key in the data of each connection (e.g. the sender's
+                           // port) that tells clients on one host apart, -1 to rate limit per host
+} ReactorListenerOptions;
+
+
+int reactor_init(Reactor *reactor, const unsigned n_threads, const int poll_timeout_msecs);
+int reactor_destroy(Reactor *reactor);
+
+int reactor_add_listener(Reactor *reactor, const int listenfd, const ReactorListenerOptions *options,
+                         const ReactorMessageHandler on_message, const ReactorStreamHandler on_stream,
+                         const ReactorTickHandler on_tick, void *context);
+int reactor_remove_listener(Reactor *reactor, const int listenfd);
+
+int reactor_resume_stream(Reactor *reactor, const void *stream);
+
+
+#endif
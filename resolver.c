@@ -0,0 +1,202 @@
+/* resolver.c
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#include "tinycthread.h"
+#include "resolver.h"
+
+#ifdef _WIN32
+  #define _WIN32_WINNT 0x501
+  #include <winsock2.h>
+  #include <ws2tcpip.h>
+  #include <windows.h>
+#else
+  #include <netdb.h>
+  #include <sys/types.h>
+  #include <sys/socket.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+typedef struct ResolverCacheEntry {
+  char *hostname;
+  char address[RESOLVER_MAX_ADDRESS_LENGTH];
+  long long expiry; // seconds
+  struct ResolverCacheEntry *next;
+} ResolverCacheEntry;
+
+typedef struct {
+  const char **hostnames;
+  char (*addresses)[RESOLVER_MAX_ADDRESS_LENGTH];
+  unsigned *pending; // indices of hostnames that need a lookup
+  unsigned n_pending;
+  unsigned next_pending;
+  int failed;
+  mtx_t mutex;
+} ResolverJob;
+
+
+static ResolverCacheEntry *cache[RESOLVER_CACHE_BUCKETS];
+static mtx_t cache_mutex;
+static once_flag cache_once = ONCE_FLAG_INIT;
+
+static void cache_init(void) {
+  mtx_init(&cache_mutex, mtx_plain);
+}
+
+static long long resolver_time_secs() {
+#ifdef _WIN32
+  return (long long) GetTickCount() / 1000;
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec;
+#endif
+}
+
+static unsigned long hash_hostname(const char *hostname) {
+  unsigned long hash = 5381; // djb2
+  for (const unsigned char *c = (const unsigned char *) hostname; *c != '\0'; c++) {
+    hash = hash * 33 + *c;
+  }
+  return hash;
+}
+
+static int cache_lookup(const char *hostname, char *address) {
+  const unsigned long bucket = hash_hostname(hostname) % RESOLVER_CACHE_BUCKETS;
+  int found = 0;
+  mtx_lock(&cache_mutex);
+  for (ResolverCacheEntry *entry = cache[bucket]; entry != NULL; entry = entry->next) {
+    if (strcmp(entry->hostname, hostname) == 0) {
+      if (entry->expiry > resolver_time_secs()) {
+        strcpy(address, entry->address);
+        found = 1;
+      }
+      break;
+    }
+  }
+  mtx_unlock(&cache_mutex);
+  return found;
+}
+
+static void cache_insert(const char *hostname, const char *address) {
+  const unsigned long bucket = hash_hostname(hostname) % RESOLVER_CACHE_BUCKETS;
+  mtx_lock(&cache_mutex);
+  ResolverCacheEntry *entry;
+  for (entry = cache[bucket]; entry != NULL; entry = entry->next) {
+    if (strcmp(entry->hostname, hostname) == 0) { // refresh an expired entry
+      break;
+    }
+  }
+  if (NULL == entry) {
+    const size_t hostname_length = strlen(hostname) + 1;
+    entry = (ResolverCacheEntry *) malloc(sizeof(ResolverCacheEntry));
+    entry->hostname = (char *) malloc(hostname_length);
+    memcpy(entry->hostname, hostname, hostname_length);
+    entry->next = cache[bucket];
+    cache[bucket] = entry;
+  }
+  strcpy(entry->address, address);
+  entry->expiry = resolver_time_secs() + RESOLVER_CACHE_TTL_SECS;
+  mtx_unlock(&cache_mutex);
+}
+
+// resolve hostname to a numeric address, without a lookup if it is a numeric address already...
+static int resolve_hostname(const char *hostname, char *address, const int numeric_only) {
+  struct addrinfo hints, *results;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC; // IPv4 or IPv6
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = numeric_only ? AI_NUMERICHOST : 0;
+  const int err = getaddrinfo(hostname, NULL, &hints, &results);
+  if (err != 0) {
+#ifdef NETISLANDS_DEBUG
+    if (!numeric_only) {
+      fprintf(stderr, "getaddrinfo: %s: %s\n", hostname, gai_strerror(err));
+    }
+#endif
+    return EXIT_FAILURE;
+  }
+  // take the first address, getaddrinfo sorts the results by preference...
+  const int ret = getnameinfo(results->ai_addr, results->ai_addrlen, address, RESOLVER_MAX_ADDRESS_LENGTH,
+                              NULL, 0, NI_NUMERICHOST) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  freeaddrinfo(results);
+  return ret;
+}
+
+static int resolver_thread_main(void *args) {
+  ResolverJob *job = (ResolverJob *) args;
+  for (;;) {
+    mtx_lock(&job->mutex);
+    const unsigned next = job->next_pending++;
+    mtx_unlock(&job->mutex);
+    if (next >= job->n_pending) {
+      break;
+    }
+    const unsigned i = job->pending[next];
+    if (resolve_hostname(job->hostnames[i], job->addresses[i], 0) == EXIT_SUCCESS) {
+      cache_insert(job->hostnames[i], job->addresses[i]);
+    } else {
+      job->addresses[i][0] = '\0';
+      mtx_lock(&job->mutex);
+      job->failed = 1;
+      mtx_unlock(&job->mutex);
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+int resolver_resolve_all(const unsigned n_hostnames,
+                         const char *hostnames[n_hostnames],
+                         char addresses[n_hostnames][RESOLVER_MAX_ADDRESS_LENGTH]) {
+  call_once(&cache_once, &cache_init);
+  ResolverJob job;
+  job.hostnames = hostnames;
+  job.addresses = addresses;
+  job.pending = (unsigned *) malloc((n_hostnames + 1) * sizeof(unsigned));
+  job.n_pending = 0;
+  job.next_pending = 0;
+  job.failed = 0;
+  // numeric addresses and cached hostnames are resolved right away...
+  for (unsigned i = 0; i < n_hostnames; i++) {
+    if (resolve_hostname(hostnames[i], addresses[i], 1) == EXIT_FAILURE
+        && !cache_lookup(hostnames[i], addresses[i])) {
+      job.pending[job.n_pending++] = i;
+    }
+  }
+  // ...the remaining hostnames are looked up concurrently, the calling thread takes part...
+  if (job.n_pending > 0) {
+    mtx_init(&job.mutex, mtx_plain);
+    unsigned n_threads = job.n_pending < RESOLVER_MAX_THREADS ? job.n_pending : RESOLVER_MAX_THREADS;
+    thrd_t threads[RESOLVER_MAX_THREADS];
+    unsigned n_started = 0;
+    for (; n_started + 1 < n_threads; n_started++) {
+      if (thrd_create(&threads[n_started], &resolver_thread_main, &job) != thrd_success) {
+        break; // the remaining threads do the work
+      }
+    }
+    resolver_thread_main(&job);
+    for (unsigned i = 0; i < n_started; i++) {
+      thrd_join(threads[i], NULL);
+    }
+    mtx_destroy(&job.mutex);
+  }
+  free(job.pending);
+  return job.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void resolver_clear_cache(void) {
+  call_once(&cache_once, &cache_init);
+  mtx_lock(&cache_mutex);
+  for (unsigned bucket = 0; bucket < RESOLVER_CACHE_BUCKETS; bucket++) {
+    while (cache[bucket] != NULL) {
+      ResolverCacheEntry *entry = cache[bucket];
+      cache[bucket] = entry->next;
+      free(entry->hostname);
+      free(entry);
+    }
+  }
+  mtx_unlock(&cache_mutex);
+}
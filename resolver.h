@@ -0,0 +1,22 @@
+/* resolver.h
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+
+#define RESOLVER_MAX_ADDRESS_LENGTH 64 // numeric IPv4 or IPv6 address, including scope id
+#define RESOLVER_MAX_THREADS 16 // maximum number of concurrent lookups
+#define RESOLVER_CACHE_TTL_SECS 300
+#define RESOLVER_CACHE_BUCKETS 256
+
+
+int resolver_resolve_all(const unsigned n_hostnames,
+                         const char *hostnames[n_hostnames],
+                         char addresses[n_hostnames][RESOLVER_MAX_ADDRESS_LENGTH]);
+
+void resolver_clear_cache(void);
+
+
+#endif
@@ -0,0 +1,295 @@
+/* topology.c
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#include "topology.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+#define TOPOLOGY_MAX_RESTARTS 1000
+
+
+typedef struct {
+  unsigned *nodes;
+  unsigned length;
+  unsigned capacity;
+} AdjacencyList;
+
+
+// deterministic pseudo random numbers (splitmix64), identical on all platforms...
+static uint64_t topology_random_next(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+static unsigned topology_random_below(uint64_t *state, const unsigned bound) {
+  return (unsigned) (topology_random_next(state) % bound);
+}
+
+static double topology_random_unit(uint64_t *state) {
+  return (topology_random_next(state) >> 11) * (1.0 / 9007199254740992.0); // 2^-53
+}
+
+static int adjacency_contains(const AdjacencyList *list, const unsigned node) {
+  for (unsigned i = 0; i < list->length; i++) {
+    if (list->nodes[i] == node) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int adjacency_add(AdjacencyList *list, const unsigned node) {
+  if (adjacency_contains(list, node)) {
+    return EXIT_SUCCESS; // no multi-edges
+  }
+  if (list->length == list->capacity) {
+    const unsigned new_capacity = list->capacity ? 2 * list->capacity : 4;
+    unsigned *new_nodes = (unsigned *) realloc(list->nodes, new_capacity * sizeof(unsigned));
+    if (NULL == new_nodes) {
+      return EXIT_FAILURE;
+    }
+    list->nodes = new_nodes;
+    list->capacity = new_capacity;
+  }
+  list->nodes[list->length++] = node;
+  return EXIT_SUCCESS;
+}
+
+static void adjacency_remove(AdjacencyList *list, const unsigned node) {
+  for (unsigned i = 0; i < list->length; i++) {
+    if (list->nodes[i] == node) {
+      list->nodes[i] = list->nodes[--list->length];
+      return;
+    }
+  }
+}
+
+static void free_adjacency_lists(AdjacencyList *lists, const unsigned n_nodes) {
+  for (unsigned i = 0; i < n_nodes; i++) {
+    free(lists[i].nodes);
+  }
+  free(lists);
+}
+
+static int add_edge(AdjacencyList *lists, const unsigned a, const unsigned b) {
+  if (adjacency_add(&lists[a], b) == EXIT_FAILURE || adjacency_add(&lists[b], a) == EXIT_FAILURE) {
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// random regular graphs are generated by pairing random edge stubs, rejecting loops and multi-edges,
+// and restarting when the remaining stubs cannot be paired anymore (Steger-Wormald)...
+static AdjacencyList *random_regular_graph(const unsigned n_nodes, const unsigned degree, uint64_t *state) {
+  if (degree >= n_nodes || ((unsigned long) n_nodes * degree) % 2 != 0) {
+    return NULL; // no such graph exists
+  }
+  const unsigned long n_stubs = (unsigned long) n_nodes * degree;
+  unsigned *stubs = (unsigned *) malloc(n_stubs * sizeof(unsigned));
+  if (NULL == stubs) {
+    return NULL;
+  }
+  for (unsigned restart = 0; restart < TOPOLOGY_MAX_RESTARTS; restart++) {
+    AdjacencyList *lists = (AdjacencyList *) calloc(n_nodes, sizeof(AdjacencyList));
+    if (NULL == lists) {
+      break;
+    }
+    for (unsigned long i = 0; i < n_stubs; i++) {
+      stubs[i] = (unsigned) (i / degree);
+    }
+    unsigned long remaining = n_stubs;
+    int stuck = 0;
+    while (remaining > 0 && !stuck) {
+      stuck = 1;
+      for (unsigned long attempt = 0; attempt < 4 * remaining + 16; attempt++) {
+        const unsigned long i = topology_random_next(state) % remaining;
+        const unsigned long j = topology_random_next(state) % remaining;
+        const unsigned a = stubs[i], b = stubs[j];
+        if (i == j || a == b || adjacency_contains(&lists[a], b)) {
+          continue;
+        }
+        if (add_edge(lists, a, b) == EXIT_FAILURE) {
+          break;
+        }
+        // remove both stubs by swapping them to the end...
+        const unsigned long hi = i > j ? i : j, lo = i > j ? j : i;
+        stubs[hi] = stubs[--remaining];
+        stubs[lo] = stubs[--remaining];
+        stuck = 0;
+        break;
+      }
+    }
+    if (!stuck) {
+      free(stubs);
+      return lists;
+    }
+    free_adjacency_lists(lists, n_nodes);
+  }
+  free(stubs);
+  return NULL;
+}
+
+// Watts-Strogatz small world graphs: a ring lattice where each node is connected to its degree / 2
+// nearest nodes on either side, each lattice edge is rewired with rewiring_probability...
+static AdjacencyList *small_world_graph(const unsigned n_nodes, const unsigned degree,
+                                        const double rewiring_probability, uint64_t *state) {
+  if (degree < 2 || degree % 2 != 0 || degree >= n_nodes) {
+    return NULL;
+  }
+  AdjacencyList *lists = (AdjacencyList *) calloc(n_nodes, sizeof(AdjacencyList));
+  if (NULL == lists) {
+    return NULL;
+  }
+  for (unsigned i = 0; i < n_nodes; i++) {
+    for (unsigned j = 1; j <= degree / 2; j++) {
+      if (add_edge(lists, i, (i + j) % n_nodes) == EXIT_FAILURE) {
+        free_adjacency_lists(lists, n_nodes);
+        return NULL;
+      }
+    }
+  }
+  for (unsigned j = 1; j <= degree / 2; j++) {
+    for (unsigned i = 0; i < n_nodes; i++) {
+      const unsigned old_target = (i + j) % n_nodes;
+      if (topology_random_unit(state) >= rewiring_probability
+          || lists[i].length >= n_nodes - 1 // node already connected to all other nodes
+          || !adjacency_contains(&lists[i], old_target)) {
+        continue;
+      }
+      unsigned new_target;
+      do {
+        new_target = topology_random_below(state, n_nodes);
+      } while (new_target == i || adjacency_contains(&lists[i], new_target));
+      adjacency_remove(&lists[i], old_target);
+      adjacency_remove(&lists[old_target], i);
+      if (add_edge(lists, i, new_target) == EXIT_FAILURE) {
+        free_adjacency_lists(lists, n_nodes);
+        return NULL;
+      }
+    }
+  }
+  return lists;
+}
+
+static unsigned near_square_width(const unsigned n_nodes) {
+  unsigned width = 1;
+  for (unsigned w = 1; (unsigned long) w * w <= n_nodes; w++) {
+    if (n_nodes % w == 0) {
+      width = w;
+    }
+  }
+  return width;
+}
+
+int topology_neighbors(const Topology *topology, const unsigned n_nodes, const unsigned node,
+                       unsigned **neighbors, unsigned *n_neighbors) {
+  if (node >= n_nodes) {
+    return EXIT_FAILURE;
+  }
+  AdjacencyList result = {NULL, 0, 0};
+  int ret = EXIT_SUCCESS;
+  switch (topology->kind) {
+  case TOPOLOGY_RING:
+    if (n_nodes > 1) {
+      ret |= adjacency_add(&result, (node + n_nodes - 1) % n_nodes);
+      ret |= adjacency_add(&result, (node + 1) % n_nodes);
+    }
+    break;
+  case TOPOLOGY_TORUS_2D: {
+    const unsigned width = topology->torus_width ? topology->torus_width : near_square_width(n_nodes);
+    if (n_nodes % width != 0) {
+      return EXIT_FAILURE;
+    }
+    const unsigned height = n_nodes / width;
+    const unsigned row = node / width, column = node % width;
+    const unsigned candidates[4] = {
+      ((row + height - 1) % height) * width + column,
+      ((row + 1) % height) * width + column,
+      row * width + (column + width - 1) % width,
+      row * width + (column + 1) % width
+    };
+    for (unsigned i = 0; i < 4; i++) {
+      if (candidates[i] != node) {
+        ret |= adjacency_add(&result, candidates[i]);
+      }
+    }
+    break;
+  }
+  case TOPOLOGY_HYPERCUBE:
+    // nodes beyond the last power of two are attached to the subcube below them, so the
+    // hypercube stays connected for arbitrary n_nodes...
+    for (unsigned long bit = 1; bit < n_nodes; bit <<= 1) {
+      const unsigned long other = node ^ bit;
+      if (other < n_nodes) {
+        ret |= adjacency_add(&result, (unsigned) other);
+      }
+    }
+    break;
+  case TOPOLOGY_RANDOM_REGULAR:
+  case TOPOLOGY_SMALL_WORLD: {
+    // every node generates the same graph from the shared seed and extracts its own neighbors...
+    uint64_t state = (uint64_t) topology->seed;
+    AdjacencyList *lists = topology->kind == TOPOLOGY_RANDOM_REGULAR
+      ? random_regular_graph(n_nodes, topology->degree, &state)
+      : small_world_graph(n_nodes, topology->degree, topology->rewiring_probability, &state);
+    if (NULL == lists) {
+      return EXIT_FAILURE;
+    }
+    result = lists[node];
+    lists[node].nodes = NULL;
+    free_adjacency_lists(lists, n_nodes);
+    break;
+  }
+  default:
+    return EXIT_FAILURE;
+  }
+  if (ret != EXIT_SUCCESS) {
+    free(result.nodes);
+    return EXIT_FAILURE;
+  }
+  *neighbors = result.nodes;
+  *n_neighbors = result.length;
+  return EXIT_SUCCESS;
+}
+
+
+// test code...
+#ifdef TOPOLOGY_TEST
+#include <stdio.h>
+
+static void test_print_topology(const char *name, const Topology *topology, const unsigned n_nodes) {
+  printf("%s with %u nodes:\n", name, n_nodes);
+  for (unsigned node = 0; node < n_nodes; node++) {
+    unsigned *neighbors, n_neighbors;
+    if (topology_neighbors(topology, n_nodes, node, &neighbors, &n_neighbors) == EXIT_FAILURE) {
+      printf("  %u: FAILED\n", node);
+      continue;
+    }
+    printf("  %u:", node);
+    for (unsigned i = 0; i < n_neighbors; i++) {
+      printf(" %u", neighbors[i]);
+    }
+    printf("\n");
+    free(neighbors);
+  }
+}
+
+int main() {
+  printf("Welcome to the Topology test program!\n");
+  Topology ring = {TOPOLOGY_RING, 0, 0, 0.0, 0};
+  test_print_topology("Ring", &ring, 5);
+  Topology torus = {TOPOLOGY_TORUS_2D, 0, 0, 0.0, 0};
+  test_print_topology("2D torus", &torus, 12);
+  Topology hypercube = {TOPOLOGY_HYPERCUBE, 0, 0, 0.0, 0};
+  test_print_topology("Hypercube", &hypercube, 11);
+  Topology random_regular = {TOPOLOGY_RANDOM_REGULAR, 3, 0, 0.0, 42};
+  test_print_topology("Random 3-regular", &random_regular, 10);
+  Topology small_world = {TOPOLOGY_SMALL_WORLD, 4, 0, 0.2, 42};
+  test_print_topology("Small world", &small_world, 10);
+  printf("All done, exiting.\n");
+  return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,31 @@
+/* topology.h
+ * Copyright (c) 2015 Oliver Flasch. All rights reserved.
+ */
+
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+
+typedef enum {
+  TOPOLOGY_RING,           // bidirectional ring, degree 2
+  TOPOLOGY_TORUS_2D,       // 2D torus (wrap-around grid), degree 4
+  TOPOLOGY_HYPERCUBE,      // (incomplete) hypercube, degree at most ceil(log2(n)), smaller for
+                           // nodes whose partners fall outside an incomplete cube
+  TOPOLOGY_RANDOM_REGULAR, // random graph, every node has exactly 'degree' neighbors
+  TOPOLOGY_SMALL_WORLD     // Watts-Strogatz ring lattice of 'degree' with random rewiring
+} TopologyKind;
+
+typedef struct {
+  TopologyKind kind;
+  unsigned degree;              // TOPOLOGY_RANDOM_REGULAR and TOPOLOGY_SMALL_WORLD only
+  unsigned torus_width;         // TOPOLOGY_TORUS_2D only, 0 selects a near-square grid
+  double rewiring_probability;  // TOPOLOGY_SMALL_WORLD only
+  unsigned long seed;           // random topologies only, must be equal on all nodes
+} Topology;
+
+
+int topology_neighbors(const Topology *topology, const unsigned n_nodes, const unsigned node,
+                       unsigned **neighbors, unsigned *n_neighbors);
+
+
+#endif